@@ -11,17 +11,70 @@ TEMPLATE = app
 
 
 SOURCES += main.cpp \
+           alloctrack.cpp \
+           audiometer.cpp \
            mainwidget.cpp \
-           glwidget.cpp
+           glaudiometer.cpp \
+           glwidget.cpp \
+           glcanvas.cpp \
+           glplanestream.cpp \
+           glscope.cpp \
+           scenedetector.cpp \
+           mediaindex.cpp \
+           fileopener.cpp \
+           qc.cpp \
+           quality.cpp \
+           rawvideoreader.cpp \
+           scoperenderer.cpp \
+           yuvconvert.cpp
 
 HEADERS  += mainwidget.h \
+            alloctrack.h \
+            analysis.h \
+            audiometer.h \
+            avdemuxer.h \
+            avringsource.h \
+            bufferpool.h \
+            compareextractor.h \
+            comparesession.h \
+            decodethread.h \
             glwidget.h \
             libav.h \
+            mediaindex.h \
+            fileopener.h \
+            framecache.h \
             frameextractor.h \
-            glcanvas.h
+            framesink.h \
+            glaudiometer.h \
+            glcanvas.h \
+            glplanestream.h \
+            glplatform.h \
+            glscope.h \
+            latencypolicy.h \
+            pipelinestats.h \
+            qc.h \
+            quality.h \
+            rawvideoreader.h \
+            scenedetector.h \
+            scopebands.h \
+            scoperenderer.h \
+            thumbnailcache.h \
+            workerpool.h \
+            yuvconvert.h
 
 QMAKE_CXXFLAGS += -std=c++11
 
+# Qt may pull in GL/gl.h before glplatform.h does
+unix:!macx: DEFINES += GL_GLEXT_PROTOTYPES
+
+# qmake CONFIG+=alloctrack counts heap allocations per pipeline stage (alloctrack.h, --alloc-check);
+# the av_malloc wrappers are exported so that the libav libraries bind to them
+alloctrack {
+    DEFINES += MTQT_ALLOC_TRACK
+    QMAKE_LFLAGS += -rdynamic
+    LIBS += -ldl
+}
+
 LIBS += -lavcodec -lavformat -lavutil -lswscale
 #INCLUDEPATH += /usr/local/include/libavcodec
 #INCLUDEPATH += /usr/local/include/libavformat
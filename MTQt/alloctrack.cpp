@@ -0,0 +1,169 @@
+#include "alloctrack.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(MTQT_ALLOC_TRACK)
+#include <dlfcn.h>
+#endif
+
+struct StageCounters
+{
+    std::atomic<uint64_t>  allocations;
+    std::atomic<uint64_t>  avAllocations;
+    std::atomic<uint64_t>  bytes;
+    std::atomic<uint64_t>  frees;
+};
+
+// Zero initialised before any constructor runs, so allocations during static initialisation count too
+static StageCounters s_counters[AllocTracker::STAGE_COUNT];
+static thread_local AllocTracker::Stage s_stage = AllocTracker::STAGE_OTHER;
+
+bool AllocTracker::IsEnabled()
+{
+#if defined(MTQT_ALLOC_TRACK)
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocTracker::Stage AllocTracker::GetStage()
+{
+    return s_stage;
+}
+
+void AllocTracker::SetStage(Stage stage)
+{
+    s_stage = stage;
+}
+
+AllocTracker::Counts AllocTracker::Get(Stage stage)
+{
+    const StageCounters& c = s_counters[stage];
+    return Counts{ c.allocations.load(), c.avAllocations.load(), c.bytes.load(), c.frees.load() };
+}
+
+AllocTracker::Counts AllocTracker::GetTotal()
+{
+    Counts total = { 0, 0, 0, 0 };
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        const Counts counts = Get(Stage(stage));
+        total.allocations += counts.allocations;
+        total.avAllocations += counts.avAllocations;
+        total.bytes += counts.bytes;
+        total.frees += counts.frees;
+    }
+    return total;
+}
+
+const char* AllocTracker::GetStageName(Stage stage)
+{
+    static const char* kNames[STAGE_COUNT] = { "other", "demux", "decode", "convert", "analysis", "display" };
+    return kNames[stage];
+}
+
+void AllocTracker::RecordAllocation(size_t bytes, bool av)
+{
+    StageCounters& c = s_counters[s_stage];
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    if (av)
+        c.avAllocations.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void AllocTracker::RecordFree()
+{
+    s_counters[s_stage].frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+#if defined(MTQT_ALLOC_TRACK)
+
+static void* Allocate(size_t size)
+{
+    AllocTracker::RecordAllocation(size, false);
+    return std::malloc(size ? size : 1);
+}
+
+static void Free(void* p)
+{
+    if (! p)
+        return;
+    AllocTracker::RecordFree();
+    std::free(p);
+}
+
+void* operator new(size_t size)
+{
+    if (void* p = Allocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    if (void* p = Allocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void operator delete(void* p) noexcept { Free(p); }
+void operator delete[](void* p) noexcept { Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Free(p); }
+
+// The libavutil functions behind the wrappers, looked up once
+template< typename TFunction >
+static TFunction Next(const char* name)
+{
+    return reinterpret_cast<TFunction>(::dlsym(RTLD_NEXT, name));
+}
+
+struct AVBufferRef;
+
+extern "C" {
+
+void* av_malloc(size_t size)
+{
+    static void* (*const next)(size_t) = Next<void* (*)(size_t)>("av_malloc");
+    AllocTracker::RecordAllocation(size, true);
+    return next(size);
+}
+
+void* av_mallocz(size_t size)
+{
+    static void* (*const next)(size_t) = Next<void* (*)(size_t)>("av_mallocz");
+    AllocTracker::RecordAllocation(size, true);
+    return next(size);
+}
+
+void* av_realloc(void* p, size_t size)
+{
+    static void* (*const next)(void*, size_t) = Next<void* (*)(void*, size_t)>("av_realloc");
+    AllocTracker::RecordAllocation(size, true);
+    if (p)
+        AllocTracker::RecordFree();
+    return next(p, size);
+}
+
+void av_free(void* p)
+{
+    static void (*const next)(void*) = Next<void (*)(void*)>("av_free");
+    if (p)
+        AllocTracker::RecordFree();
+    next(p);
+}
+
+AVBufferRef* av_buffer_alloc(int size)
+{
+    static AVBufferRef* (*const next)(int) = Next<AVBufferRef* (*)(int)>("av_buffer_alloc");
+    AllocTracker::RecordAllocation(size, true);
+    return next(size);
+}
+
+} // extern "C"
+
+#endif
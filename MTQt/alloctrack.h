@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Heap allocation counters per pipeline stage, to find churn in the playback path. The
+// stage is per thread and set by AllocTracker::Scope around the work of a stage.
+//
+// Counting needs the build with CONFIG+=alloctrack. It replaces the global operator new
+// and delete, and puts wrappers around av_malloc, av_mallocz, av_realloc, av_free and
+// av_buffer_alloc in front of libavutil, so the calls the other libav libraries make go
+// through them too. Calls inside libavutil itself are not seen. In other builds
+// IsEnabled() is false and all counts stay zero.
+class AllocTracker
+{
+public:
+    enum Stage {
+        STAGE_OTHER,
+        STAGE_DEMUX,
+        STAGE_DECODE,
+        STAGE_CONVERT,
+        STAGE_ANALYSIS,
+        STAGE_DISPLAY,
+        STAGE_COUNT
+    };
+
+    struct Counts {
+        uint64_t  allocations; // operator new and av_* together
+        uint64_t  avAllocations;
+        uint64_t  bytes;
+        uint64_t  frees;
+    };
+
+    class Scope
+    {
+    public:
+        explicit Scope(Stage stage) : m_previous(GetStage()) { SetStage(stage); }
+        ~Scope() { SetStage(m_previous); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const Stage m_previous;
+    };
+
+    static bool IsEnabled();
+
+    static Stage GetStage();
+    static void SetStage(Stage stage);
+
+    static Counts Get(Stage stage);
+    static Counts GetTotal();
+    static const char* GetStageName(Stage stage);
+
+    // For the hooks
+    static void RecordAllocation(size_t bytes, bool av);
+    static void RecordFree();
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "audiometer.h"
+#include "libav.h"
+#include "mediaindex.h"
+#include "qc.h"
+#include "scenedetector.h"
+
+#include <memory>
+
+// Optional per-frame analysis stages. Disabled stages cost nothing.
+class FrameAnalysis : NoCopy
+{
+public:
+    void EnableSceneDetection(bool enable)
+    {
+        if (! enable)
+            m_sceneDetector.reset();
+        else if (! m_sceneDetector)
+            m_sceneDetector.reset(new SceneDetector());
+    }
+
+    void EnableIndexing(bool enable)
+    {
+        if (! enable)
+            m_indexBuilder.reset();
+        else if (! m_indexBuilder)
+            m_indexBuilder.reset(new MediaIndexBuilder());
+    }
+
+    void EnableQc(bool enable)
+    {
+        if (! enable)
+            m_qc.reset();
+        else if (! m_qc)
+            m_qc.reset(new QcAnalyzer());
+    }
+
+    void EnableAudioMeter(bool enable)
+    {
+        if (! enable)
+            m_audioMeter.reset();
+        else if (! m_audioMeter)
+            m_audioMeter.reset(new AudioMeter());
+    }
+
+    SceneDetector* GetSceneDetector() const { return m_sceneDetector.get(); }
+    MediaIndexBuilder* GetIndexBuilder() const { return m_indexBuilder.get(); }
+    QcAnalyzer* GetQc() const { return m_qc.get(); }
+    AudioMeter* GetAudioMeter() const { return m_audioMeter.get(); }
+
+    void Analyze(const libav::AVFrame& frame)
+    {
+        AllocTracker::Scope stage(AllocTracker::STAGE_ANALYSIS);
+        double sceneScore = 0.0;
+        if (m_sceneDetector) {
+            m_sceneDetector->Feed(frame);
+            const std::vector<SceneCut>& cuts = m_sceneDetector->GetCuts();
+            if (! cuts.empty() && cuts.back().timestamp == frame.GetTimestamp() && cuts.back().type == SceneCut::CUT)
+                sceneScore = cuts.back().score;
+        }
+        if (m_indexBuilder)
+            m_indexBuilder->Add(frame, sceneScore);
+        if (m_qc)
+            m_qc->Feed(frame);
+    }
+
+    void Analyze(const libav::AVSamples& samples)
+    {
+        AllocTracker::Scope stage(AllocTracker::STAGE_ANALYSIS);
+        if (m_audioMeter)
+            m_audioMeter->Feed(samples);
+    }
+
+private:
+    std::unique_ptr<SceneDetector> m_sceneDetector;
+    std::unique_ptr<MediaIndexBuilder> m_indexBuilder;
+    std::unique_ptr<QcAnalyzer> m_qc;
+    std::unique_ptr<AudioMeter> m_audioMeter;
+};
+
+
+// Runs the analysis on everything AVStream::Decode hands out before passing it on
+template< typename TCallback >
+struct AnalysisCallback {
+    bool&           stopped;
+    TCallback&      next;
+    FrameAnalysis&  analysis;
+
+    AnalysisCallback(TCallback& callback, FrameAnalysis& frameAnalysis)
+        : stopped(callback.stopped)
+        , next(callback)
+        , analysis(frameAnalysis)
+    { }
+
+    template< typename TFrame >
+    bool operator()(const TFrame& frame, int index) {
+        analysis.Analyze(frame);
+        return next(frame, index);
+    }
+};
@@ -0,0 +1,372 @@
+#include "audiometer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const unsigned kHistory = AudioMeter::TRUE_PEAK_TAPS - 1;
+static const size_t kMomentaryIntervals = 4;   // 400 ms
+static const size_t kShortTermIntervals = 30;  // 3 s
+static const double kAbsoluteGate = -70.0;     // LUFS
+static const double kRelativeGate = -10.0;     // LU below the ungated loudness
+
+// Four channels side by side; everything below is written once against these
+#if defined(__SSE2__)
+typedef __m128 Lanes;
+static inline Lanes Load(const float* p) { return _mm_loadu_ps(p); }
+static inline void Store(float* p, Lanes v) { _mm_storeu_ps(p, v); }
+static inline Lanes Splat(float f) { return _mm_set1_ps(f); }
+static inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+static inline Lanes Abs(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#else
+struct Lanes { float f[4]; };
+static inline Lanes Load(const float* p) { Lanes r; for (int i = 0; i < 4; ++i) r.f[i] = p[i]; return r; }
+static inline void Store(float* p, Lanes v) { for (int i = 0; i < 4; ++i) p[i] = v.f[i]; }
+static inline Lanes Splat(float f) { Lanes r; for (int i = 0; i < 4; ++i) r.f[i] = f; return r; }
+static inline Lanes Add(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.f[i] += b.f[i]; return a; }
+static inline Lanes Sub(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.f[i] -= b.f[i]; return a; }
+static inline Lanes Mul(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.f[i] *= b.f[i]; return a; }
+static inline Lanes Max(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.f[i] = std::max(a.f[i], b.f[i]); return a; }
+static inline Lanes Abs(Lanes a) { for (int i = 0; i < 4; ++i) a.f[i] = std::fabs(a.f[i]); return a; }
+#endif
+
+// Transposed direct form II with the state in z1 and z2; coefficients b0 b1 b2 a1 a2
+static inline Lanes Biquad(Lanes x, const float* c, Lanes& z1, Lanes& z2)
+{
+    const Lanes y = Add(Mul(Splat(c[0]), x), z1);
+    z1 = Sub(Add(Mul(Splat(c[1]), x), z2), Mul(Splat(c[3]), y));
+    z2 = Sub(Mul(Splat(c[2]), x), Mul(Splat(c[4]), y));
+    return y;
+}
+
+AudioMeter::AudioMeter()
+    : m_channels(0)
+    , m_groups(0)
+    , m_sampleRate(0)
+    , m_intervalFrames(0)
+    , m_antiDenormal(1e-15f)
+    , m_fill(0)
+    , m_timestamp(0)
+    , m_programFrames(0)
+    , m_intervals(0)
+    , m_maxMomentary(-HUGE_VAL)
+    , m_maxShortTerm(-HUGE_VAL)
+{
+    std::fill(m_shelf, m_shelf + 5, 0.0f);
+    std::fill(m_highPass, m_highPass + 5, 0.0f);
+
+    // Blackman windowed sinc interpolator, cut off at the original Nyquist frequency; phase p
+    // produces the sample p / OVERSAMPLING after the newest input
+    const unsigned taps = OVERSAMPLING * TRUE_PEAK_TAPS;
+    const double center = (taps - 1) / 2.0;
+    for (unsigned n = 0; n < taps; ++n) {
+        const double t = (n - center) / OVERSAMPLING;
+        const double sinc = t == 0.0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t);
+        const double window = 0.42 - 0.5 * std::cos(2 * M_PI * (n + 0.5) / taps) + 0.08 * std::cos(4 * M_PI * (n + 0.5) / taps);
+        m_phases[n % OVERSAMPLING][n / OVERSAMPLING] = float(sinc * window);
+    }
+    for (unsigned p = 0; p < OVERSAMPLING; ++p) {
+        double sum = 0.0;
+        for (unsigned k = 0; k < TRUE_PEAK_TAPS; ++k)
+            sum += m_phases[p][k];
+        for (unsigned k = 0; k < TRUE_PEAK_TAPS; ++k)
+            m_phases[p][k] = float(m_phases[p][k] / sum); // unity gain at DC
+    }
+}
+
+bool AudioMeter::IsSupported(::AVSampleFormat format)
+{
+    return format == AV_SAMPLE_FMT_S16 || format == AV_SAMPLE_FMT_FLT || format == AV_SAMPLE_FMT_S16P || format == AV_SAMPLE_FMT_FLTP;
+}
+
+bool AudioMeter::Feed(const libav::AVSamples& samples)
+{
+    if (! samples.GetCodecContext())
+        return false;
+    const libav::AVSampleFormat format = samples.GetFormat();
+    if (! IsSupported(format.format) || ! format.channels)
+        return false;
+    // avcodec_decode_audio3 hands out planar audio as one plane per channel, back to back
+    const bool planar = format.format == AV_SAMPLE_FMT_S16P || format.format == AV_SAMPLE_FMT_FLTP;
+    if (format.format == AV_SAMPLE_FMT_S16 || format.format == AV_SAMPLE_FMT_S16P) {
+        const size_t frames = samples.GetSize() / (sizeof(int16_t) * format.channels);
+        return FeedSamples(samples.GetRaw(), frames, format.channels, planar, format.sampleRate, samples.GetTimestamp());
+    }
+    const size_t frames = samples.GetSize() / (sizeof(float) * format.channels);
+    return FeedSamples(reinterpret_cast<const float*>(samples.GetRaw()), frames, format.channels, planar, format.sampleRate, samples.GetTimestamp());
+}
+
+bool AudioMeter::Feed(const int16_t* samples, size_t frames, unsigned channels, unsigned sampleRate, uint64_t timestamp)
+{
+    return FeedSamples(samples, frames, channels, false, sampleRate, timestamp);
+}
+
+bool AudioMeter::Feed(const float* samples, size_t frames, unsigned channels, unsigned sampleRate, uint64_t timestamp)
+{
+    return FeedSamples(samples, frames, channels, false, sampleRate, timestamp);
+}
+
+static inline float ToFloat(int16_t sample) { return sample * (1.0f / 32768); }
+static inline float ToFloat(float sample) { return sample; }
+
+template< typename TSample >
+bool AudioMeter::FeedSamples(const TSample* samples, size_t frames, unsigned channels, bool planar, unsigned sampleRate, uint64_t timestamp)
+{
+    if (! channels || sampleRate < 1000 / INTERVAL_MS)
+        return false;
+    if (channels != m_channels || sampleRate != m_sampleRate)
+        Configure(channels, sampleRate);
+
+    const unsigned stride = m_groups * 4;
+    const size_t frameStep = planar ? 1 : channels, channelStep = planar ? frames : 1;
+    size_t done = 0;
+    while (done < frames) {
+        if (! m_fill)
+            m_timestamp = timestamp + done * 1000 / sampleRate;
+        const size_t count = std::min<size_t>(frames - done, m_intervalFrames - m_fill);
+
+        // Deinterleave into the lanes, the padding channels stay silent
+        float* block = m_input.data() + kHistory * stride;
+        for (size_t i = 0; i < count; ++i) {
+            const TSample* in = samples + (done + i) * frameStep;
+            float* out = block + i * stride;
+            for (unsigned c = 0; c < channels; ++c)
+                out[c] = ToFloat(in[c * channelStep]);
+        }
+        Process(count);
+        std::copy(m_input.begin() + count * stride, m_input.begin() + (count + kHistory) * stride, m_input.begin());
+
+        done += count;
+        m_fill += unsigned(count);
+        if (m_fill == m_intervalFrames)
+            CompleteInterval();
+    }
+    return true;
+}
+
+void AudioMeter::Finish()
+{
+    if (m_fill)
+        CompleteInterval();
+}
+
+void AudioMeter::Configure(unsigned channels, unsigned sampleRate)
+{
+    m_channels = channels;
+    m_groups = (channels + 3) / 4;
+    m_sampleRate = sampleRate;
+    m_intervalFrames = sampleRate * INTERVAL_MS / 1000;
+
+    const unsigned lanes = m_groups * 4;
+    m_input.assign((kHistory + m_intervalFrames) * lanes, 0.0f);
+    m_filter.assign(lanes * 4, 0.0f);
+    m_peak.assign(lanes, 0.0f);
+    m_truePeak.assign(lanes, 0.0f);
+    m_square.assign(lanes, 0.0f);
+    m_plain.assign(lanes, 0.0f);
+
+    // BS.1770 channel weights; in the 5.1 order of libav the LFE is left out and the
+    // surrounds count 1.41 times
+    m_weights.assign(lanes, 0.0f);
+    for (unsigned c = 0; c < channels; ++c)
+        m_weights[c] = 1.0f;
+    if (channels == 6) {
+        m_weights[3] = 0.0f;
+        m_weights[4] = m_weights[5] = 1.41f;
+    }
+
+    // The K-weighting pre-filter (high shelf) and RLB high pass, re-derived for the sample rate
+    // from the analog prototypes so that 48 kHz gives the coefficients of the standard
+    {
+        const double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+        const double k = std::tan(M_PI * f0 / sampleRate);
+        const double vh = std::pow(10.0, gain / 20.0);
+        const double vb = std::pow(vh, 0.4996667741545416);
+        const double a0 = 1.0 + k / q + k * k;
+        m_shelf[0] = float((vh + vb * k / q + k * k) / a0);
+        m_shelf[1] = float(2.0 * (k * k - vh) / a0);
+        m_shelf[2] = float((vh - vb * k / q + k * k) / a0);
+        m_shelf[3] = float(2.0 * (k * k - 1.0) / a0);
+        m_shelf[4] = float((1.0 - k / q + k * k) / a0);
+    }
+    {
+        const double f0 = 38.13547087602444, q = 0.5003270373238773;
+        const double k = std::tan(M_PI * f0 / sampleRate);
+        const double a0 = 1.0 + k / q + k * k;
+        m_highPass[0] = 1.0f;
+        m_highPass[1] = -2.0f;
+        m_highPass[2] = 1.0f;
+        m_highPass[3] = float(2.0 * (k * k - 1.0) / a0);
+        m_highPass[4] = float((1.0 - k / q + k * k) / a0);
+    }
+    Reset();
+}
+
+void AudioMeter::Reset()
+{
+    std::fill(m_input.begin(), m_input.end(), 0.0f);
+    std::fill(m_filter.begin(), m_filter.end(), 0.0f);
+    std::fill(m_peak.begin(), m_peak.end(), 0.0f);
+    std::fill(m_truePeak.begin(), m_truePeak.end(), 0.0f);
+    std::fill(m_square.begin(), m_square.end(), 0.0f);
+    std::fill(m_plain.begin(), m_plain.end(), 0.0f);
+    m_fill = 0;
+    m_timestamp = 0;
+    m_energies.clear();
+    m_blocks.clear();
+    m_programSquares.assign(m_channels, 0.0);
+    m_programFrames = 0;
+    m_intervals = 0;
+    m_maxMomentary = -HUGE_VAL;
+    m_maxShortTerm = -HUGE_VAL;
+
+    const AudioChannelLevels silence = { 0.0f, 0.0f, 0.0f };
+    m_last.timestamp = 0;
+    m_last.momentary = -HUGE_VAL;
+    m_last.shortTerm = -HUGE_VAL;
+    m_last.channels.assign(m_channels, silence);
+    m_program.assign(m_channels, silence);
+}
+
+void AudioMeter::Process(size_t frames)
+{
+    const unsigned stride = m_groups * 4;
+    const float* block = m_input.data() + kHistory * stride;
+    for (unsigned g = 0; g < m_groups; ++g) {
+        float* state = &m_filter[g * 16];
+        Lanes z1 = Load(state), z2 = Load(state + 4), z3 = Load(state + 8), z4 = Load(state + 12);
+        Lanes peak = Load(&m_peak[g * 4]), truePeak = Load(&m_truePeak[g * 4]);
+        Lanes square = Load(&m_square[g * 4]), plain = Load(&m_plain[g * 4]);
+        float antiDenormal = m_antiDenormal;
+
+        const float* in = block + g * 4;
+        for (size_t i = 0; i < frames; ++i, in += stride) {
+            const Lanes x = Load(in);
+            peak = Max(peak, Abs(x));
+            plain = Add(plain, Mul(x, x));
+
+            const Lanes shelved = Biquad(Add(x, Splat(antiDenormal)), m_shelf, z1, z2);
+            const Lanes weighted = Biquad(shelved, m_highPass, z3, z4);
+            square = Add(square, Mul(weighted, weighted));
+            antiDenormal = -antiDenormal;
+
+            for (unsigned p = 0; p < OVERSAMPLING; ++p) {
+                Lanes sum = Mul(Splat(m_phases[p][0]), x);
+                for (unsigned k = 1; k < TRUE_PEAK_TAPS; ++k)
+                    sum = Add(sum, Mul(Splat(m_phases[p][k]), Load(in - k * stride)));
+                truePeak = Max(truePeak, Abs(sum));
+            }
+        }
+
+        Store(state, z1);
+        Store(state + 4, z2);
+        Store(state + 8, z3);
+        Store(state + 12, z4);
+        Store(&m_peak[g * 4], peak);
+        Store(&m_truePeak[g * 4], truePeak);
+        Store(&m_square[g * 4], square);
+        Store(&m_plain[g * 4], plain);
+        if (g + 1 == m_groups)
+            m_antiDenormal = antiDenormal;
+    }
+}
+
+static double MeanOfLast(const std::vector<double>& values, size_t count)
+{
+    double sum = 0.0;
+    for (size_t i = values.size() - count; i < values.size(); ++i)
+        sum += values[i];
+    return sum / count;
+}
+
+void AudioMeter::CompleteInterval()
+{
+    double energy = 0.0;
+    for (unsigned c = 0; c < m_channels; ++c) {
+        AudioChannelLevels& levels = m_last.channels[c];
+        levels.peak = m_peak[c];
+        levels.truePeak = std::max(m_truePeak[c], m_peak[c]);
+        levels.rms = std::sqrt(m_plain[c] / m_fill);
+        energy += m_weights[c] * double(m_square[c]) / m_fill;
+
+        AudioChannelLevels& program = m_program[c];
+        program.peak = std::max(program.peak, levels.peak);
+        program.truePeak = std::max(program.truePeak, levels.truePeak);
+        m_programSquares[c] += m_plain[c];
+        program.rms = float(std::sqrt(m_programSquares[c] / (m_programFrames + m_fill)));
+    }
+    m_programFrames += m_fill;
+
+    // A partial interval, from Finish(), keeps the loudness of the last complete one
+    m_last.timestamp = m_timestamp;
+    if (m_fill == m_intervalFrames) {
+        m_energies.push_back(energy);
+        if (m_energies.size() > kShortTermIntervals)
+            m_energies.erase(m_energies.begin());
+
+        m_last.momentary = -HUGE_VAL;
+        m_last.shortTerm = -HUGE_VAL;
+        if (m_energies.size() >= kMomentaryIntervals) {
+            const double block = MeanOfLast(m_energies, kMomentaryIntervals);
+            m_blocks.push_back(block); // gating blocks overlap by 75%
+            m_last.momentary = ToLufs(block);
+            m_maxMomentary = std::max(m_maxMomentary, m_last.momentary);
+        }
+        if (m_energies.size() >= kShortTermIntervals) {
+            m_last.shortTerm = ToLufs(MeanOfLast(m_energies, kShortTermIntervals));
+            m_maxShortTerm = std::max(m_maxShortTerm, m_last.shortTerm);
+        }
+    }
+
+    std::fill(m_peak.begin(), m_peak.end(), 0.0f);
+    std::fill(m_truePeak.begin(), m_truePeak.end(), 0.0f);
+    std::fill(m_square.begin(), m_square.end(), 0.0f);
+    std::fill(m_plain.begin(), m_plain.end(), 0.0f);
+    m_fill = 0;
+    ++m_intervals;
+
+    if (m_onInterval)
+        m_onInterval(m_last);
+}
+
+double AudioMeter::GetIntegrated() const
+{
+    double sum = 0.0;
+    size_t count = 0;
+    for (double block : m_blocks) {
+        if (ToLufs(block) > kAbsoluteGate) {
+            sum += block;
+            ++count;
+        }
+    }
+    if (! count)
+        return -HUGE_VAL;
+
+    const double threshold = ToLufs(sum / count) + kRelativeGate;
+    sum = 0.0;
+    count = 0;
+    for (double block : m_blocks) {
+        const double loudness = ToLufs(block);
+        if (loudness > kAbsoluteGate && loudness > threshold) {
+            sum += block;
+            ++count;
+        }
+    }
+    return count ? ToLufs(sum / count) : -HUGE_VAL;
+}
+
+double AudioMeter::ToDb(double linear)
+{
+    return linear > 0.0 ? 20.0 * std::log10(linear) : -HUGE_VAL;
+}
+
+double AudioMeter::ToLufs(double meanSquare)
+{
+    return meanSquare > 0.0 ? -0.691 + 10.0 * std::log10(meanSquare) : -HUGE_VAL;
+}
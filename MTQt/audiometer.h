@@ -0,0 +1,108 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct AudioChannelLevels
+{
+    float  peak;      // sample peak, linear full scale
+    float  truePeak;  // 4x oversampled, linear full scale
+    float  rms;       // linear full scale
+};
+
+
+// One 100 ms interval of metering
+struct AudioInterval
+{
+    uint64_t                         timestamp;  // milliseconds, of the first sample
+    double                           momentary;  // LUFS over the last 400 ms
+    double                           shortTerm;  // LUFS over the last 3 s
+    std::vector<AudioChannelLevels>  channels;   // over the interval
+};
+
+
+// Audio levels for broadcast QC: per channel sample peak, RMS and true peak, and EBU R128
+// momentary, short-term and integrated loudness (ITU-R BS.1770 K-weighting and gating).
+// Channels are processed four at a time in SIMD lanes, so the cost grows with the number
+// of channel groups rather than channels.
+class AudioMeter : NoCopy
+{
+public:
+    static const unsigned INTERVAL_MS = 100;
+    static const unsigned OVERSAMPLING = 4;
+    static const unsigned TRUE_PEAK_TAPS = 12; // per phase
+
+    AudioMeter();
+
+    static bool IsSupported(::AVSampleFormat format); // 16 bit integer or float, packed or planar
+
+    // Returns false for formats the meter cannot read. A change of channel count or sample
+    // rate restarts the measurement.
+    bool Feed(const libav::AVSamples& samples);
+    bool Feed(const int16_t* samples, size_t frames, unsigned channels, unsigned sampleRate, uint64_t timestamp);
+    bool Feed(const float* samples, size_t frames, unsigned channels, unsigned sampleRate, uint64_t timestamp);
+    // Completes the last, partial interval at the end of the stream. Its levels count,
+    // its loudness does not: a gating block needs the full 400 ms.
+    void Finish();
+    void Reset();
+
+    // Called for every completed interval
+    void SetIntervalCallback(std::function<void(const AudioInterval&)> callback) { m_onInterval = callback; }
+
+    unsigned GetChannels() const { return m_channels; }
+    unsigned GetSampleRate() const { return m_sampleRate; }
+    uint64_t GetIntervalCount() const { return m_intervals; }
+
+    const AudioInterval& GetLast() const { return m_last; }
+    const std::vector<AudioChannelLevels>& GetProgram() const { return m_program; } // maxima and overall RMS
+    double GetIntegrated() const; // LUFS, gated
+    double GetMaxMomentary() const { return m_maxMomentary; }
+    double GetMaxShortTerm() const { return m_maxShortTerm; }
+
+    static double ToDb(double linear);           // -inf for silence
+    static double ToLufs(double meanSquare);     // -inf for silence
+
+private:
+    void Configure(unsigned channels, unsigned sampleRate);
+    template< typename TSample >
+    bool FeedSamples(const TSample* samples, size_t frames, unsigned channels, bool planar, unsigned sampleRate, uint64_t timestamp);
+    void Process(size_t frames);
+    void CompleteInterval();
+
+private:
+    unsigned  m_channels;
+    unsigned  m_groups;       // of four channels, the last one padded with silence
+    unsigned  m_sampleRate;
+    unsigned  m_intervalFrames;
+
+    // Lane data, m_groups * 4 floats per sample frame
+    std::vector<float>  m_input;   // TRUE_PEAK_TAPS - 1 frames of history, then the block
+    std::vector<float>  m_filter;  // biquad states, 4 per group
+    std::vector<float>  m_weights; // channel weighting of the loudness sum
+    std::vector<float>  m_peak;
+    std::vector<float>  m_truePeak;
+    std::vector<float>  m_square;  // K-weighted sums of squares
+    std::vector<float>  m_plain;   // unweighted sums of squares
+
+    float  m_shelf[5];  // b0 b1 b2 a1 a2
+    float  m_highPass[5];
+    float  m_phases[OVERSAMPLING][TRUE_PEAK_TAPS];
+    float  m_antiDenormal; // alternating, keeps the filter states out of denormals in silence
+
+    unsigned             m_fill;         // frames of the current interval
+    uint64_t             m_timestamp;    // of the current interval
+    std::vector<double>  m_energies;     // K-weighted mean square of the last 30 intervals
+    std::vector<double>  m_blocks;       // of all 400 ms gating blocks
+    std::vector<double>  m_programSquares;
+    uint64_t             m_programFrames;
+    uint64_t             m_intervals;
+    double               m_maxMomentary;
+    double               m_maxShortTerm;
+
+    AudioInterval                    m_last;
+    std::vector<AudioChannelLevels>  m_program;
+    std::function<void(const AudioInterval&)>  m_onInterval;
+};
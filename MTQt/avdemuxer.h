@@ -0,0 +1,281 @@
+#pragma once
+
+#include "libav.h"
+#include "pipelinestats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libav {
+
+// Keeps packet objects around for reuse instead of creating one per av_read_frame
+class AVPacketPool : NoCopy
+{
+public:
+    std::unique_ptr<AVPacket> Acquire()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free.empty()) {
+            ++m_allocated;
+            return std::unique_ptr<AVPacket>(new AVPacket());
+        }
+        std::unique_ptr<AVPacket> packet = std::move(m_free.back());
+        m_free.pop_back();
+        return packet;
+    }
+
+    void Release(std::unique_ptr<AVPacket> packet)
+    {
+        packet->Reset();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(std::move(packet));
+    }
+
+    size_t GetAllocated() const { return m_allocated; }
+
+private:
+    std::mutex                               m_mutex;
+    std::vector<std::unique_ptr<AVPacket>>   m_free;
+    std::atomic<size_t>                      m_allocated{0};
+};
+
+
+// Reads packets on its own thread into one bounded queue per stream, so that I/O
+// overlaps with decoding. A queue blocks the reader once it holds `maxQueueBytes`.
+class AVDemuxer : public IAVPacketSource, NoCopy
+{
+    struct Entry {
+        uint64_t                   sequence; // demux order across all queues
+        std::unique_ptr<AVPacket>  packet;
+    };
+
+    struct Queue {
+        std::deque<Entry>  entries;
+        size_t             bytes = 0;
+        bool               wanted = true;
+    };
+
+public:
+    // Packets of streams not listed in `streams` are dropped right away; empty means all streams
+    AVDemuxer(const AVInputFile& input, const std::vector<unsigned>& streams = std::vector<unsigned>(),
+              size_t maxQueueBytes = 16 << 20)
+        : m_input(input)
+        , m_maxQueueBytes(maxQueueBytes)
+        , m_queues(input.GetStreamCount())
+        , m_sequence(0)
+        , m_eof(false)
+        , m_stopped(false)
+        , m_quit(false)
+        , m_seekPending(false)
+        , m_seekIndex(0)
+        , m_seekTimestamp(0)
+        , m_seekResult(false)
+    {
+        if (! streams.empty()) {
+            for (Queue& queue : m_queues)
+                queue.wanted = false;
+            for (unsigned index : streams)
+                if (index < m_queues.size())
+                    m_queues[index].wanted = true;
+        }
+        m_thread = std::thread(&AVDemuxer::Run, this);
+    }
+
+    virtual ~AVDemuxer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+    }
+
+    virtual bool Read(AVPacket& packet, bool& stopped) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Queue* next = NextQueue();
+        if (! next && ! m_eof && ! m_stopped) {
+            StageTimer::Scope starved(PipelineStats::Instance().decodeStarved);
+            m_cond.wait(lock, [this, &next]() { return (next = NextQueue()) || m_eof || m_stopped; });
+        }
+
+        stopped = m_stopped;
+        if (! next)
+            return false;
+
+        Entry entry = std::move(next->entries.front());
+        next->entries.pop_front();
+        next->bytes -= entry.packet->Size();
+        lock.unlock();
+        m_cond.notify_all();
+
+        packet.Swap(*entry.packet);
+        m_pool.Release(std::move(entry.packet));
+        return true;
+    }
+
+    virtual bool Seek(unsigned streamIndex, int64_t sourceTimestamp) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_seekPending = true;
+        m_seekIndex = streamIndex;
+        m_seekTimestamp = sourceTimestamp;
+        m_cond.notify_all();
+        m_cond.wait(lock, [this]() { return ! m_seekPending; });
+        return m_seekResult;
+    }
+
+    // True if Read() would return without waiting
+    bool Ready() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_eof || m_stopped)
+            return true;
+        return std::any_of(m_queues.begin(), m_queues.end(), [](const Queue& q) { return ! q.entries.empty(); });
+    }
+
+    // Drops every queued packet older than the newest queued keyframe of `streamIndex`, so a
+    // live stream that fell behind resumes at a point the decoder can start from. Returns the
+    // number of packets dropped.
+    size_t SkipToLatestKeyframe(unsigned streamIndex)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (streamIndex >= m_queues.size())
+            return 0;
+
+        const std::deque<Entry>& entries = m_queues[streamIndex].entries;
+        auto key = std::find_if(entries.rbegin(), entries.rend(), [](const Entry& e) { return e.packet->IsKey(); });
+        if (key == entries.rend())
+            return 0;
+
+        const uint64_t sequence = key->sequence;
+        size_t dropped = 0;
+        for (Queue& queue : m_queues) {
+            while (! queue.entries.empty() && queue.entries.front().sequence < sequence) {
+                queue.bytes -= queue.entries.front().packet->Size();
+                m_pool.Release(std::move(queue.entries.front().packet));
+                queue.entries.pop_front();
+                ++dropped;
+            }
+        }
+        m_cond.notify_all();
+        return dropped;
+    }
+
+    size_t GetPoolSize() const { return m_pool.GetAllocated(); }
+
+private:
+    // Called with the lock held. Pushes happen in sequence order, so the lowest head is the next packet.
+    Queue* NextQueue()
+    {
+        Queue* next = nullptr;
+        for (Queue& queue : m_queues) {
+            if (! queue.entries.empty() && (! next || queue.entries.front().sequence < next->entries.front().sequence))
+                next = &queue;
+        }
+        return next;
+    }
+
+    void Flush()
+    {
+        for (Queue& queue : m_queues) {
+            for (Entry& entry : queue.entries)
+                m_pool.Release(std::move(entry.packet));
+            queue.entries.clear();
+            queue.bytes = 0;
+        }
+    }
+
+    void HandleSeek()
+    {
+        Flush();
+        m_seekResult = m_input.Seek(m_seekIndex, m_seekTimestamp);
+        m_eof = false;
+        m_seekPending = false;
+        m_cond.notify_all();
+    }
+
+    void Run()
+    {
+        AllocTracker::Scope stage(AllocTracker::STAGE_DEMUX);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (! m_quit) {
+            if (m_seekPending) {
+                HandleSeek();
+                continue;
+            }
+            if (m_eof || m_stopped) {
+                m_cond.wait(lock, [this]() { return m_quit || m_seekPending; });
+                continue;
+            }
+
+            lock.unlock();
+            std::unique_ptr<AVPacket> packet = m_pool.Acquire();
+            bool stopped = false;
+            const bool read = packet->Read(m_input, stopped);
+            lock.lock();
+
+            if (m_seekPending) { // the packet belongs to the old position
+                m_pool.Release(std::move(packet));
+                continue;
+            }
+            if (! read) {
+                m_pool.Release(std::move(packet));
+                m_eof = ! stopped;
+                m_stopped = stopped;
+                m_cond.notify_all();
+                continue;
+            }
+
+            if (packet->Index() >= m_queues.size() || ! m_queues[packet->Index()].wanted) {
+                m_pool.Release(std::move(packet));
+                continue;
+            }
+
+            // Back-pressure on the byte size, a single oversized packet is still let through
+            Queue& queue = m_queues[packet->Index()];
+            const size_t size = packet->Size();
+            if (queue.bytes && queue.bytes + size > m_maxQueueBytes) {
+                StageTimer::Scope stalled(PipelineStats::Instance().demuxStall);
+                m_cond.wait(lock, [&]() { return m_quit || m_seekPending || ! queue.bytes || queue.bytes + size <= m_maxQueueBytes; });
+                if (m_quit || m_seekPending) {
+                    m_pool.Release(std::move(packet));
+                    continue;
+                }
+            }
+
+            queue.entries.push_back(Entry{ m_sequence++, std::move(packet) });
+            queue.bytes += size;
+            m_cond.notify_all();
+        }
+        Flush();
+    }
+
+private:
+    const AVInputFile&        m_input;
+    const size_t              m_maxQueueBytes;
+    AVPacketPool              m_pool;
+
+    mutable std::mutex        m_mutex;
+    std::condition_variable   m_cond;
+    std::vector<Queue>        m_queues;
+    uint64_t                  m_sequence;
+    bool                      m_eof;
+    bool                      m_stopped;
+    bool                      m_quit;
+
+    bool                      m_seekPending;
+    unsigned                  m_seekIndex;
+    int64_t                   m_seekTimestamp;
+    bool                      m_seekResult;
+
+    std::thread               m_thread;
+};
+
+} // namespace libav
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "libav.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace libav {
+
+// Non-seekable input from a FIFO or a UNIX stream socket. A thread drains the descriptor
+// into a ring buffer, so the writer is never held up by a slow av_read_frame; once the
+// ring is full the thread stops reading and the writer blocks on the pipe.
+class AVRingBufferSource : public IAVDataSource, NoCopy
+{
+public:
+    explicit AVRingBufferSource(const char* path, size_t capacity = 4 << 20)
+        : m_path(path)
+        , m_buffer(capacity)
+        , m_head(0)
+        , m_size(0)
+        , m_fd(-1)
+        , m_eof(false)
+        , m_stopped(false)
+    {
+        m_thread = std::thread(&AVRingBufferSource::Run, this);
+    }
+
+    virtual ~AVRingBufferSource()
+    {
+        Stop();
+        m_thread.join();
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    // True for paths that can only be read once, front to back
+    static bool IsStreamingPath(const char* path)
+    {
+        struct stat st;
+        return ::stat(path, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+    }
+
+    // Makes pending and future reads return end of stream
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cond.notify_all();
+    }
+
+    size_t GetBuffered() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    virtual size_t Read(void* buf, size_t size) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_size || m_eof || m_stopped; });
+        if (m_stopped)
+            return 0;
+
+        // Hand out whatever is there instead of waiting for `size` bytes
+        size_t done = 0;
+        while (done < size && m_size) {
+            const size_t chunk = std::min(std::min(size - done, m_size), m_buffer.size() - m_head);
+            memcpy(static_cast<uint8_t*>(buf) + done, &m_buffer[m_head], chunk);
+            m_head = (m_head + chunk) % m_buffer.size();
+            m_size -= chunk;
+            done += chunk;
+        }
+        lock.unlock();
+        m_cond.notify_all();
+        return done;
+    }
+
+    virtual size_t PreferredSize() const override { return 32 << 10; } // MPEG-TS arrives in small bursts
+
+protected:
+    virtual bool OkToRead() const override { return ! m_stopped; }
+
+private:
+    int Open() const
+    {
+        struct stat st;
+        if (::stat(m_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (m_path.size() >= sizeof(address.sun_path))
+                return -1;
+            strcpy(address.sun_path, m_path.c_str());
+
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+            return fd;
+        }
+        // Non-blocking, so that waiting for the writer to show up can be stopped
+        return ::open(m_path.c_str(), O_RDONLY | O_NONBLOCK);
+    }
+
+    void Run()
+    {
+        m_fd = Open();
+
+        std::vector<uint8_t> chunk(64 << 10);
+        while (m_fd >= 0 && ! m_stopped) {
+            pollfd pfd = { m_fd, POLLIN, 0 };
+            const int ready = ::poll(&pfd, 1, 100); // wake up now and then to notice Stop()
+            if (ready < 0 && errno != EINTR)
+                break;
+            if (ready <= 0)
+                continue;
+
+            const ssize_t got = ::read(m_fd, chunk.data(), chunk.size());
+            if (got < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (got <= 0)
+                break;
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            size_t done = 0;
+            while (done < size_t(got)) {
+                m_cond.wait(lock, [this]() { return m_size < m_buffer.size() || m_stopped; });
+                if (m_stopped)
+                    return;
+                const size_t tail = (m_head + m_size) % m_buffer.size();
+                const size_t space = std::min(m_buffer.size() - m_size, m_buffer.size() - tail);
+                const size_t count = std::min(space, size_t(got) - done);
+                memcpy(&m_buffer[tail], chunk.data() + done, count);
+                m_size += count;
+                done += count;
+                m_cond.notify_all();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_eof = true;
+        m_cond.notify_all();
+    }
+
+private:
+    const std::string         m_path;
+    std::vector<uint8_t>      m_buffer;
+    size_t                    m_head;
+    size_t                    m_size;
+    int                       m_fd;
+
+    mutable std::mutex        m_mutex;
+    std::condition_variable   m_cond;
+    bool                      m_eof;
+    std::atomic<bool>         m_stopped;
+    std::thread               m_thread;
+};
+
+} // namespace libav
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace libav {
+
+// Recycles large temporary buffers (pictures, sample buffers) by size class, so that
+// steady-state playback does not go to the system allocator. Buffers are 64 byte aligned;
+// classes of 2 MiB and up are mapped directly and may be backed by transparent huge pages.
+class AVBufferPool
+{
+public:
+    static const size_t ALIGNMENT = 64;
+    static const size_t HUGE_PAGE = 2 << 20;
+
+    struct Stats {
+        uint64_t  systemAllocations;
+        uint64_t  systemFrees;
+        uint64_t  reused;
+        size_t    bytesInUse;
+        size_t    bytesRetained; // free buffers kept for reuse
+    };
+
+    static AVBufferPool& Instance()
+    {
+        static AVBufferPool pool;
+        return pool;
+    }
+
+    // Classes are spaced a quarter of a power of two apart, wasting at most 25%
+    static size_t SizeClass(size_t size)
+    {
+        if (size <= ALIGNMENT)
+            return ALIGNMENT;
+        unsigned log = 0;
+        while ((size_t(1) << (log + 1)) < size)
+            ++log;
+        const size_t step = std::max(size_t(1) << log >> 2, size_t(ALIGNMENT));
+        return (size + step - 1) / step * step;
+    }
+
+    void* Acquire(size_t size)
+    {
+        const size_t sizeClass = SizeClass(size);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.bytesInUse += sizeClass;
+            std::vector<void*>& free = m_free[sizeClass];
+            if (! free.empty()) {
+                void* buffer = free.back();
+                free.pop_back();
+                m_stats.bytesRetained -= sizeClass;
+                ++m_stats.reused;
+                return buffer;
+            }
+            ++m_stats.systemAllocations;
+        }
+
+        void* buffer = SystemAllocate(sizeClass);
+        if (! buffer) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.bytesInUse -= sizeClass;
+            throw std::bad_alloc();
+        }
+        return buffer;
+    }
+
+    void Release(void* buffer, size_t size)
+    {
+        if (! buffer)
+            return;
+        const size_t sizeClass = SizeClass(size);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.bytesInUse -= sizeClass;
+            if (m_stats.bytesRetained + sizeClass <= m_maxRetained) {
+                std::vector<void*>& free = m_free[sizeClass];
+                free.push_back(buffer);
+                m_stats.bytesRetained += sizeClass;
+                return;
+            }
+            ++m_stats.systemFrees;
+        }
+        SystemFree(buffer, sizeClass);
+    }
+
+    // Returns all retained buffers to the system
+    void Trim()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_free) {
+            for (void* buffer : entry.second) {
+                SystemFree(buffer, entry.first);
+                ++m_stats.systemFrees;
+            }
+            m_stats.bytesRetained -= entry.first * entry.second.size();
+            entry.second.clear();
+        }
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    void SetMaxRetained(size_t bytes) { std::lock_guard<std::mutex> lock(m_mutex); m_maxRetained = bytes; }
+    void SetHugePages(bool enable) { m_hugePages = enable; }
+
+private:
+    AVBufferPool()
+        : m_maxRetained(size_t(512) << 20)
+        , m_hugePages(true)
+    {
+        m_stats = Stats{ 0, 0, 0, 0, 0 };
+    }
+
+    ~AVBufferPool()
+    {
+        Trim();
+    }
+
+    AVBufferPool(const AVBufferPool&) = delete;
+    AVBufferPool& operator=(const AVBufferPool&) = delete;
+
+    void* SystemAllocate(size_t sizeClass) const
+    {
+        if (sizeClass >= HUGE_PAGE) {
+            void* buffer = ::mmap(nullptr, sizeClass, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (buffer == MAP_FAILED)
+                return nullptr;
+#if defined(MADV_HUGEPAGE)
+            if (m_hugePages)
+                ::madvise(buffer, sizeClass, MADV_HUGEPAGE); // only a hint
+#endif
+            return buffer;
+        }
+        void* buffer = nullptr;
+        return ::posix_memalign(&buffer, ALIGNMENT, sizeClass) == 0 ? buffer : nullptr;
+    }
+
+    static void SystemFree(void* buffer, size_t sizeClass)
+    {
+        if (sizeClass >= HUGE_PAGE)
+            ::munmap(buffer, sizeClass);
+        else
+            ::free(buffer);
+    }
+
+private:
+    mutable std::mutex                   m_mutex;
+    std::map<size_t, std::vector<void*>> m_free;
+    Stats                                m_stats;
+    size_t                               m_maxRetained;
+    std::atomic<bool>                    m_hugePages;
+};
+
+} // namespace libav
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "comparesession.h"
+#include "mainwidget.h"
+#include "quality.h"
+#include "libav.h"
+
+#include <QTimerEvent>
+
+#include <memory>
+
+// Plays a reference and a distorted version side by side, frame by frame in sync
+class CompareExtractor : public QObject {
+    Q_OBJECT
+
+public:
+    CompareExtractor(MainWidget& frameReceiver, std::unique_ptr<OpenedMedia> reference, std::unique_ptr<OpenedMedia> distorted)
+        : m_frameReceiver(frameReceiver)
+        , m_session(std::move(reference), std::move(distorted))
+        , m_measure(true)
+        , m_showDifference(false)
+        , m_timerId(startTimer(1000 / 30))
+    {
+    }
+
+    ~CompareExtractor()
+    {
+        killTimer(m_timerId); // Precaution
+    }
+
+    const CompareSession& GetSession() const { return m_session; }
+
+    bool IsMeasuring() const { return m_measure; }
+    void SetMeasuring(bool measure) { m_measure = measure; }
+
+    // Shows the amplified luma difference instead of the distorted picture
+    bool IsShowingDifference() const { return m_showDifference; }
+    void SetShowDifference(bool show) { m_showDifference = show; }
+
+private:
+    virtual void timerEvent(QTimerEvent* timerEvent) {
+        if (timerEvent->timerId() != m_timerId)
+            return;
+        if (! m_session.Next(m_pair)) {
+            killTimer(m_timerId);
+            m_timerId = 0;
+            return;
+        }
+
+        FrameQuality quality;
+        if (m_measure)
+            quality = QualityMeter::Measure(*m_pair.reference, *m_pair.distorted);
+
+        const libav::AVFrame* comparison = m_pair.distorted.get();
+        if (m_showDifference) {
+            UpdateDifference();
+            comparison = m_difference.get();
+        }
+        m_frameReceiver.FeedFrame(m_pair.reference.get());
+        m_frameReceiver.FeedComparison(comparison, m_pair.distorted.get(), m_measure ? &quality : nullptr);
+    }
+
+    void UpdateDifference() {
+        const libav::AVFrame& reference = *m_pair.reference;
+        const libav::AVFrame& distorted = *m_pair.distorted;
+        if (! m_difference || m_difference->GetWidth() != reference.GetWidth() || m_difference->GetHeight() != reference.GetHeight())
+            m_difference.reset(new libav::AVTempFrame(libav::AVImageFormat(reference.GetWidth(), reference.GetHeight(), PIX_FMT_GRAY8)));
+
+        for (unsigned y = 0; y < reference.GetHeight(); ++y) {
+            QualityMeter::AbsoluteDifference(reference.GetPlane(0) + size_t(y) * reference.GetLineSize(0),
+                                             distorted.GetPlane(0) + size_t(y) * distorted.GetLineSize(0),
+                                             m_difference->GetRaw()->data[0] + size_t(y) * m_difference->GetLineSize(0),
+                                             reference.GetWidth());
+        }
+        m_difference->SetTimeBase(reference.GetTimeBase());
+        m_difference->SetTimeOffset(reference.GetTimeOffset());
+        m_difference->SetSourceTimestamp(reference.GetSourceTimestamp());
+    }
+
+private:
+    MainWidget&                          m_frameReceiver;
+    CompareSession                       m_session;
+    FramePair                            m_pair;       // shown until the next tick
+    std::unique_ptr<libav::AVTempFrame>  m_difference;
+    bool                                 m_measure;
+    bool                                 m_showDifference;
+    int                                  m_timerId;
+};
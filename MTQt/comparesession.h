@@ -0,0 +1,78 @@
+#pragma once
+
+#include "decodethread.h"
+#include "fileopener.h"
+#include "libav.h"
+
+#include <algorithm>
+#include <memory>
+
+struct FramePair
+{
+    std::unique_ptr<libav::AVTempFrame>  reference;
+    std::unique_ptr<libav::AVTempFrame>  distorted; // same size and format as `reference`
+};
+
+
+// Decodes a reference and a distorted version in parallel and pairs their frames by timestamp
+class CompareSession : NoCopy
+{
+public:
+    CompareSession(std::unique_ptr<OpenedMedia> reference, std::unique_ptr<OpenedMedia> distorted)
+        : m_reference(std::move(reference))
+        , m_distorted(std::move(distorted))
+        , m_lastTimestamp(0)
+        , m_hasLast(false)
+        , m_unmatched(0)
+    { }
+
+    const OpenedMedia& GetReference() const { return m_reference.GetMedia(); }
+    const OpenedMedia& GetDistorted() const { return m_distorted.GetMedia(); }
+    uint64_t GetUnmatched() const { return m_unmatched; } // frames of either side without a partner
+
+    // Blocks until the next pair that is at most half a frame apart; false at the end of either stream
+    bool Next(FramePair& pair)
+    {
+        for (;;) {
+            std::unique_ptr<libav::AVTempFrame> reference = m_reference.Pop();
+            if (! reference)
+                return false;
+
+            const uint64_t timestamp = reference->GetTimestamp();
+            const uint64_t tolerance = m_hasLast && timestamp > m_lastTimestamp ? std::max<uint64_t>((timestamp - m_lastTimestamp) / 2, 1) : 20;
+            m_lastTimestamp = timestamp;
+            m_hasLast = true;
+
+            // Skip distorted frames that are closer to an earlier reference frame
+            const libav::AVTempFrame* distorted = m_distorted.Peek();
+            while (distorted && distorted->GetTimestamp() + tolerance < timestamp) {
+                m_distorted.Pop();
+                ++m_unmatched;
+                distorted = m_distorted.Peek();
+            }
+            if (! distorted)
+                return false;
+            if (distorted->GetTimestamp() > timestamp + tolerance) {
+                ++m_unmatched; // dropped in the distorted version
+                continue;
+            }
+
+            pair.reference = std::move(reference);
+            pair.distorted = m_distorted.Pop();
+            const ::AVFrame& r = *pair.reference->GetRaw();
+            const ::AVFrame& d = *pair.distorted->GetRaw();
+            if (r.width != d.width || r.height != d.height || r.format != d.format) {
+                const libav::AVImageFormat format(r.width, r.height, static_cast<enum ::PixelFormat>(r.format));
+                pair.distorted.reset(new libav::AVTempFrame(format, *pair.distorted));
+            }
+            return true;
+        }
+    }
+
+private:
+    DecodeThread  m_reference;
+    DecodeThread  m_distorted;
+    uint64_t      m_lastTimestamp;
+    bool          m_hasLast;
+    uint64_t      m_unmatched;
+};
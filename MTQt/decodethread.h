@@ -0,0 +1,102 @@
+#pragma once
+
+#include "fileopener.h"
+#include "libav.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Decodes one opened media on its own thread into a short queue of frame copies
+class DecodeThread : NoCopy
+{
+public:
+    DecodeThread(std::unique_ptr<OpenedMedia> media, size_t capacity = 4)
+        : m_media(std::move(media))
+        , m_capacity(capacity)
+        , m_finished(false)
+        , m_quit(false)
+    {
+        m_thread = std::thread(&DecodeThread::Run, this);
+    }
+
+    ~DecodeThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+    }
+
+    const OpenedMedia& GetMedia() const { return *m_media; }
+
+    // Blocks until a frame is available; nullptr once the stream has ended
+    const libav::AVTempFrame* Peek()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return ! m_frames.empty() || m_finished; });
+        return m_frames.empty() ? nullptr : m_frames.front().get();
+    }
+
+    std::unique_ptr<libav::AVTempFrame> Pop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return ! m_frames.empty() || m_finished; });
+        if (m_frames.empty())
+            return nullptr;
+        std::unique_ptr<libav::AVTempFrame> frame = std::move(m_frames.front());
+        m_frames.pop_front();
+        lock.unlock();
+        m_cond.notify_all();
+        return frame;
+    }
+
+private:
+    bool Push(const libav::AVFrame& videoFrame)
+    {
+        // Copy outside the lock, the decoder reuses `videoFrame` for the next picture
+        std::unique_ptr<libav::AVTempFrame> copy(new libav::AVTempFrame(videoFrame));
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_frames.size() < m_capacity || m_quit; });
+        if (m_quit)
+            return false;
+        m_frames.push_back(std::move(copy));
+        lock.unlock();
+        m_cond.notify_all();
+        return true;
+    }
+
+    void Run()
+    {
+        try {
+            while (const libav::AVFrame* frame = m_media->stream->NextVideoFrame([this]() { return ! m_quit; })) {
+                if (! Push(*frame))
+                    break;
+            }
+        } catch (const std::exception&) {
+            // treated as the end of the stream
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+        m_cond.notify_all();
+    }
+
+private:
+    std::unique_ptr<OpenedMedia>                      m_media;
+    const size_t                                      m_capacity;
+
+    std::mutex                                        m_mutex;
+    std::condition_variable                           m_cond;
+    std::deque<std::unique_ptr<libav::AVTempFrame>>   m_frames;
+    bool                                              m_finished;
+    std::atomic<bool>                                 m_quit;
+
+    std::thread                                       m_thread;
+};
@@ -0,0 +1,111 @@
+#include "fileopener.h"
+#include "pipelinestats.h"
+
+FileOpener::FileOpener(const std::string& fileName, const libav::AVOpenOptions& options, QObject* parent)
+    : QObject(parent)
+    , m_media(new OpenedMedia())
+    , m_options(options)
+    , m_cancelled(std::make_shared<std::atomic<bool>>(false))
+{
+    m_media->fileName = fileName;
+    if (libav::AVRingBufferSource::IsStreamingPath(fileName.c_str()))
+        m_media->source.reset(new libav::AVRingBufferSource(fileName.c_str()));
+}
+
+FileOpener::~FileOpener()
+{
+    Cancel();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void FileOpener::Cancel()
+{
+    *m_cancelled = true;
+    if (m_media && m_media->source)
+        m_media->source->Stop(); // avformat_open_input may be waiting for the first bytes
+}
+
+void FileOpener::Start()
+{
+    if (! m_thread.joinable())
+        m_thread = std::thread(&FileOpener::Run, this, m_options);
+}
+
+std::unique_ptr<OpenedMedia> FileOpener::TakeMedia()
+{
+    // The opened input keeps polling the old flag, cancelling from now on must not reach it
+    m_cancelled = std::make_shared<std::atomic<bool>>(false);
+    return std::move(m_media);
+}
+
+libav::AVOpenOptions FileOpener::InteractiveOptions()
+{
+    libav::AVOpenOptions options;
+    options.probeSize = 1 << 20;          // 1 MiB
+    options.analyzeDuration = 1000000;    // 1 second
+    options.streamInfo = libav::AVOpenOptions::STREAM_INFO_AUTO;
+    return options;
+}
+
+libav::AVOpenOptions FileOpener::LiveOptions()
+{
+    libav::AVOpenOptions options;
+    options.probeSize = 32 << 10;         // a few hundred MPEG-TS packets
+    options.analyzeDuration = 100000;     // 100 ms
+    options.streamInfo = libav::AVOpenOptions::STREAM_INFO_AUTO;
+    options.formatFlags = AVFMT_FLAG_NOBUFFER;
+    options.lowDelay = true;
+    return options;
+}
+
+void FileOpener::Run(libav::AVOpenOptions options)
+{
+    // Chain the caller's interrupt with our own cancellation flag
+    std::function<bool()> interrupt = options.interrupt;
+    std::shared_ptr<std::atomic<bool>> cancelled = m_cancelled;
+    options.interrupt = [cancelled, interrupt]() { return cancelled->load() || (interrupt && interrupt()); };
+
+    StageTimer::Scope timing(PipelineStats::Instance().open);
+    try {
+        OpenedMedia& media = *m_media;
+        if (media.IsLive()) {
+            // The scopes of a live feed are counted while the decoder hands out the rows
+            media.scopeBands.reset(new ScopeBands());
+            ScopeBands* const bands = media.scopeBands.get();
+            const std::function<void(const libav::AVBand&)> next = options.videoBands;
+            options.videoBands = [bands, next](const libav::AVBand& band) {
+                bands->Feed(band);
+                if (next)
+                    next(band);
+            };
+        }
+        emit Progress(0, tr("opening"));
+        if (media.source)
+            media.input.reset(new libav::AVInputFile(*media.source, media.fileName.c_str(), options));
+        else
+            media.input.reset(new libav::AVInputFile(media.fileName.c_str(), options));
+        if (*cancelled)
+            return;
+
+        emit Progress(60, tr("opening decoders"));
+        media.stream.reset(new libav::AVStream(*media.input));
+        if (*cancelled)
+            return;
+
+        // Start reading ahead right away, the first packets are ready by the time the GUI asks
+        media.demuxer.reset(new libav::AVDemuxer(*media.input, media.stream->GetStreamIndexes()));
+        media.stream->SetPacketSource(media.demuxer.get());
+
+        if (! media.IsLive()) {
+            emit Progress(90, tr("loading index"));
+            media.index = MediaIndex::Open(media.fileName.c_str());
+        }
+
+        emit Progress(100, media.input->GetStreamInfoProbed() ? tr("probed") : tr("headers only"));
+        emit Opened();
+    } catch (const std::exception&) {
+        if (! *cancelled)
+            emit Failed(tr("cannot open %1").arg(QString::fromStdString(m_media->fileName)));
+    }
+}
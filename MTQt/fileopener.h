@@ -0,0 +1,72 @@
+#pragma once
+
+#include "avdemuxer.h"
+#include "avringsource.h"
+#include "libav.h"
+#include "mediaindex.h"
+#include "scopebands.h"
+
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Everything a FrameExtractor needs, set up away from the GUI thread
+struct OpenedMedia
+{
+    std::string                                  fileName;
+    std::unique_ptr<libav::AVRingBufferSource>   source;  // FIFOs and sockets only, outlives `input`
+    std::unique_ptr<ScopeBands>                  scopeBands; // live feeds, counted by `stream`'s decoder
+    std::unique_ptr<libav::AVInputFile>          input;
+    std::unique_ptr<libav::AVStream>             stream;
+    std::unique_ptr<libav::AVDemuxer>            demuxer; // feeds `stream`, destroyed before it
+    std::unique_ptr<MediaIndex>                  index;
+
+    ~OpenedMedia()
+    {
+        if (source)
+            source->Stop(); // the demuxer thread may be waiting for live data
+    }
+
+    bool IsLive() const { return source != nullptr; }
+};
+
+
+// Opens a file on a background thread from Start(). Progress(), Opened() and Failed() are delivered
+// to the thread the opener lives in; destroying the opener cancels a pending open.
+class FileOpener : public QObject
+{
+    Q_OBJECT
+
+public:
+    FileOpener(const std::string& fileName, const libav::AVOpenOptions& options, QObject* parent = nullptr);
+    ~FileOpener();
+
+    // Starts opening; call it once the signals are connected
+    void Start();
+    void Cancel();
+    // After Opened(); the opener no longer cancels what it hands out
+    std::unique_ptr<OpenedMedia> TakeMedia();
+
+    // Defaults for interactive use: probe only what the container headers leave open
+    static libav::AVOpenOptions InteractiveOptions();
+    // Live feeds: probe as little as possible and hand out every packet as soon as it arrives
+    static libav::AVOpenOptions LiveOptions();
+
+signals:
+    void Progress(int percent, QString stage);
+    void Opened();
+    void Failed(QString reason);
+
+private:
+    void Run(libav::AVOpenOptions options);
+
+private:
+    std::unique_ptr<OpenedMedia>        m_media;
+    libav::AVOpenOptions                m_options;
+    std::shared_ptr<std::atomic<bool>>  m_cancelled; // shared with the input's interrupt callback, which outlives us
+    std::thread                         m_thread;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+
+// Recently decoded pictures by timestamp, holding references to the decoder's buffers
+// rather than copies. Frames inserted one after another in decode order are linked, so
+// stepping to a neighbour inside a cached run is a lookup instead of a seek and decode.
+class FrameCache : NoCopy
+{
+public:
+    typedef std::shared_ptr<const libav::AVFrame> Frame;
+
+    explicit FrameCache(size_t maxBytes = size_t(256) << 20)
+        : m_maxBytes(maxBytes)
+        , m_bytes(0)
+        , m_last(NONE)
+    { }
+
+    // `follows` tells whether `frame` is the successor of the previously inserted frame
+    void Insert(const libav::AVFrame& frame, bool follows)
+    {
+        const uint64_t timestamp = frame.GetTimestamp();
+        const uint64_t previous = follows ? m_last : NONE;
+        m_last = timestamp;
+        if (previous != NONE) {
+            auto it = m_entries.find(previous);
+            if (it != m_entries.end())
+                it->second.next = timestamp;
+        }
+
+        auto it = m_entries.find(timestamp);
+        if (it != m_entries.end()) { // already there, possibly from another run
+            if (previous != NONE)
+                it->second.previous = previous;
+            Touch(it);
+            return;
+        }
+
+        std::shared_ptr<libav::AVFrame> reference(new libav::AVFrame());
+        reference->Ref(frame);
+
+        const ::AVFrame& raw = *frame.GetRaw();
+        const size_t bytes = ::avpicture_get_size(static_cast< ::PixelFormat>(raw.format), raw.width, raw.height);
+        m_lru.push_front(timestamp);
+        m_entries[timestamp] = Entry{ reference, bytes, previous, NONE, m_lru.begin() };
+        m_bytes += bytes;
+        Evict();
+    }
+
+    // Breaks the chain, e.g. after a seek
+    void Interrupt() { m_last = NONE; }
+
+    Frame Find(uint64_t timestamp)
+    {
+        auto it = m_entries.find(timestamp);
+        if (it == m_entries.end())
+            return nullptr;
+        Touch(it);
+        return it->second.frame;
+    }
+
+    // The cached frame decoded right before / after the one at `timestamp`, nullptr if not known
+    Frame FindPrevious(uint64_t timestamp) { return FindLinked(timestamp, &Entry::previous); }
+    Frame FindNext(uint64_t timestamp) { return FindLinked(timestamp, &Entry::next); }
+
+    void Clear()
+    {
+        m_entries.clear();
+        m_lru.clear();
+        m_bytes = 0;
+        m_last = NONE;
+    }
+
+    size_t GetMaxBytes() const { return m_maxBytes; }
+    void SetMaxBytes(size_t maxBytes) { m_maxBytes = maxBytes; Evict(); }
+    size_t GetBytes() const { return m_bytes; }
+    size_t GetCount() const { return m_entries.size(); }
+
+private:
+    static const uint64_t NONE = ~uint64_t(0);
+
+    struct Entry {
+        Frame                          frame;
+        size_t                         bytes;
+        uint64_t                       previous;
+        uint64_t                       next;
+        std::list<uint64_t>::iterator  lru;
+    };
+    typedef std::map<uint64_t, Entry> Entries;
+
+    Frame FindLinked(uint64_t timestamp, uint64_t Entry::* link)
+    {
+        auto it = m_entries.find(timestamp);
+        if (it == m_entries.end() || it->second.*link == NONE)
+            return nullptr;
+        return Find(it->second.*link);
+    }
+
+    void Touch(Entries::iterator it)
+    {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    }
+
+    void Evict()
+    {
+        while (m_bytes > m_maxBytes && ! m_lru.empty()) {
+            auto it = m_entries.find(m_lru.back());
+            m_bytes -= it->second.bytes;
+            m_entries.erase(it);
+            m_lru.pop_back();
+        }
+    }
+
+private:
+    Entries              m_entries;
+    std::list<uint64_t>  m_lru;     // most recently used first
+    size_t               m_maxBytes;
+    size_t               m_bytes;
+    uint64_t             m_last;    // timestamp of the last inserted frame
+};
@@ -1,35 +1,40 @@
 #pragma once
 
-#include "mainwidget.h"
+#include "analysis.h"
+#include "fileopener.h"
+#include "framecache.h"
+#include "framesink.h"
+#include "latencypolicy.h"
 #include "libav.h"
+#include "pipelinestats.h"
 
 #include <QString>
 #include <QTimerEvent>
 
-#include <queue>
+#include <QElapsedTimer>
+
+#include <memory>
 
 class FrameExtractor : public QObject {
     Q_OBJECT
 
-    struct FrameCallbackHandler {
-        bool stopped;
-        std::queue<const libav::AVFrame*> videoFrames;
-
-        bool operator()(const libav::AVFrame& videoFrame, int /*index*/) {
-            videoFrames.push(&videoFrame);
-            return true;
-        }
-
-        bool operator()(const libav::AVSamples& /*samples*/ , int /*index*/) { return true; } // ignore audio samples
-    };
-
 public:
-    FrameExtractor(MainWidget& frameReceiver, const char* filename)
+    FrameExtractor(IFrameSink& frameReceiver, std::unique_ptr<OpenedMedia> media)
         : m_frameReceiver(frameReceiver)
-        , m_inputFile(filename)
-        , m_fileStream(m_inputFile)
-        , m_timerId(startTimer(1000 / 30))
+        , m_media(std::move(media))
+        , m_position(0)
+        , m_skipUntil(0)
+        , m_turbo(false)
+        , m_paused(false)
+        , m_inSync(true)
+        , m_previewPlayback(false)
+        , m_timerId(startTimer(GetInterval()))
     {
+        // Without a sidecar index, build one while playing through the file
+        if (! m_media->index && ! m_media->IsLive())
+            m_analysis.EnableIndexing(true);
+        if (m_media->input->HasStream(AVMEDIA_TYPE_AUDIO))
+            m_analysis.EnableAudioMeter(true);
     }
 
     ~FrameExtractor()
@@ -37,32 +42,302 @@ public:
         killTimer(m_timerId); // Precaution
     }
 
+    FrameAnalysis& GetAnalysis() { return m_analysis; }
+    // Live feeds only: the scopes, counted while the decoder handed out the rows
+    const ScopeBands* GetScopeBands() const { return m_media ? m_media->scopeBands.get() : nullptr; }
+    FrameCache& GetFrameCache() { return m_frameCache; }
+
+    // Stops playback and hands the media over, e.g. to a comparison
+    std::unique_ptr<OpenedMedia> TakeMedia()
+    {
+        StopTimer();
+        return std::move(m_media);
+    }
+
+    const MediaIndex* GetIndex() const { return m_media->index.get(); }
+    uint64_t GetPosition() const { return m_position; }
+    LatencyPolicy& GetLatencyPolicy() { return m_latency; }
+    bool IsTurbo() const { return m_turbo; }
+    bool IsEnded() const { return m_media->stream->IsEnded(); }
+    int GetRefreshInterval() const { return GetInterval(); } // milliseconds
+
+    // Decodes and analyses as fast as possible, but only shows the newest frame at each refresh
+    void SetTurbo(bool turbo)
+    {
+        if (turbo == m_turbo || m_media->IsLive())
+            return;
+        m_turbo = turbo;
+        m_frameCache.Interrupt(); // turbo skips frames without caching them
+        if (m_timerId) {
+            killTimer(m_timerId);
+            m_timerId = startTimer(GetInterval());
+        }
+    }
+
+    void Seek(uint64_t timestamp) // milliseconds
+    {
+        if (! SeekStream(timestamp))
+            return;
+        m_skipUntil = timestamp;
+        if (m_paused)
+            ShowDecoded();
+        else if (! m_timerId)
+            m_timerId = startTimer(GetInterval());
+    }
+
+    bool IsPaused() const { return m_paused; }
+
+    void SetPaused(bool paused)
+    {
+        if (paused == m_paused || m_media->IsLive())
+            return;
+        m_paused = paused;
+        if (paused) {
+            StopTimer();
+            if (m_previewPlayback)
+                SetPreview(false);
+            return;
+        }
+        if (m_previewPlayback)
+            SetPreview(true);
+        if (! m_inSync)
+            Resync();
+        m_timerId = startTimer(GetInterval());
+    }
+
+    bool IsPreviewPlayback() const { return m_previewPlayback; }
+
+    // Plays with the preview decode profile; whenever playback pauses, the frame on screen
+    // is decoded again at full quality
+    void SetPreviewPlayback(bool preview)
+    {
+        if (preview == m_previewPlayback || m_media->IsLive())
+            return;
+        m_previewPlayback = preview;
+        SetPreview(preview && ! m_paused);
+    }
+
+    void StepForward()
+    {
+        SetPaused(true);
+        if (FrameCache::Frame next = m_frameCache.FindNext(m_position)) {
+            Show(next);
+            return;
+        }
+        if (! m_inSync)
+            Resync();
+        ShowDecoded();
+    }
+
+    // Inside a cached GOP this is a lookup; otherwise the GOP before the current frame is
+    // decoded into the cache first, so the following steps back are lookups too
+    void StepBackward()
+    {
+        SetPaused(true);
+        FrameCache::Frame previous = m_frameCache.FindPrevious(m_position);
+        if (! previous && m_position) {
+            Prefetch(m_position);
+            previous = m_frameCache.FindPrevious(m_position);
+        }
+        if (previous)
+            Show(previous);
+    }
+
 private:
+    static const int kTurboBudget = 12; // milliseconds of each 16 ms refresh
+
+    int GetInterval() const { return m_media->IsLive() || m_turbo ? 1000 / 60 : 1000 / 30; }
+
     virtual void timerEvent(QTimerEvent* timerEvent) {
         if (timerEvent->timerId() == m_timerId) {
-            if (ProceedDecoding()) {
-                m_frameReceiver.FeedFrame(m_callback.videoFrames.front());
-                m_callback.videoFrames.pop();
+            if (m_media->IsLive()) {
+                ProceedLive();
+            } else if (m_turbo) {
+                ProceedTurbo();
+            } else {
+                ShowDecoded();
             }
         }
     }
 
-    bool ProceedDecoding() {
-        bool decoded = true;
-        while (m_callback.videoFrames.empty() && decoded)
-            decoded = m_fileStream.Decode(m_callback, true);
+    void StopTimer() {
+        if (m_timerId)
+            killTimer(m_timerId);
+        m_timerId = 0;
+    }
+
+    bool SeekStream(uint64_t timestamp) {
+        bool sought = false;
+        if (m_media->index) {
+            if (const MediaIndexKeyframe* keyframe = m_media->index->FindKeyframe(timestamp))
+                sought = m_media->stream->SeekSource(keyframe->sourceTimestamp);
+        }
+        if (! sought && ! m_media->stream->Seek(timestamp))
+            return false;
+
+        if (MediaIndexBuilder* builder = m_analysis.GetIndexBuilder())
+            builder->Invalidate();
+        if (AudioMeter* meter = m_analysis.GetAudioMeter())
+            meter->Reset(); // levels and loudness start over at the new position
+        m_frameCache.Interrupt();
+        m_skipUntil = 0;
+        return true;
+    }
+
+    void SetPreview(bool preview) {
+        if (preview == m_media->stream->GetPreview())
+            return;
+        m_media->stream->SetPreview(preview);
+        m_frameCache.Clear(); // never step from a full quality frame to a preview, or back
+        if (! m_paused) {
+            if (m_shown || m_position)
+                Resync(); // the decoder may have dropped its reference pictures
+        } else if (SeekStream(m_position)) {
+            m_skipUntil = m_position;
+            ShowDecoded();
+        }
+    }
+
+    // Positions the decoder right after the frame on screen, which came from the cache
+    void Resync() {
+        if (SeekStream(m_position))
+            m_skipUntil = m_position + 1;
+        m_inSync = true;
+    }
 
-        if (! decoded || m_callback.stopped) {
+    // The next frame from the decoder; shown through its cached reference, so it stays
+    // valid after the decoder has moved on
+    void ShowDecoded() {
+        const libav::AVFrame* frame = ProceedDecoding();
+        if (! frame)
+            return;
+        m_frameCache.Insert(*frame, true);
+        m_position = frame->GetTimestamp();
+        m_shown = m_frameCache.Find(m_position);
+        m_inSync = true;
+        m_frameReceiver.FeedFrame(m_shown ? m_shown.get() : frame);
+    }
+
+    void Show(const FrameCache::Frame& frame) {
+        m_shown = frame;
+        m_position = frame->GetTimestamp();
+        m_inSync = false;
+        m_frameReceiver.FeedFrame(frame.get());
+    }
+
+    // Decodes from the keyframe before `until` up to the frame at `until` into the cache
+    void Prefetch(uint64_t until) {
+        if (! SeekStream(until - 1))
+            return;
+        while (const libav::AVFrame* frame = m_media->stream->NextVideoFrame()) {
+            ++PipelineStats::Instance().decodedFrames;
+            m_frameCache.Insert(*frame, true);
+            if (frame->GetTimestamp() >= until)
+                break;
+        }
+        m_inSync = false;
+    }
+
+    // The next frame to show, straight from the decoder; every decoded frame is analysed,
+    // the ones on the way from a keyframe to a seek target are not shown. The audio in
+    // between goes to the meter.
+    template< typename TMayRead >
+    const libav::AVFrame* NextFrame(TMayRead mayRead) {
+        const auto onAudio = [this](const libav::AVSamples& samples) { m_analysis.Analyze(samples); };
+        while (const libav::AVFrame* frame = m_media->stream->NextVideoFrame(mayRead, onAudio)) {
+            ++PipelineStats::Instance().decodedFrames;
+            m_analysis.Analyze(*frame);
+            if (frame->GetTimestamp() >= m_skipUntil)
+                return frame;
+        }
+        return nullptr;
+    }
+
+    const libav::AVFrame* ProceedDecoding() {
+        const libav::AVFrame* frame = NextFrame([]() { return true; });
+        if (! frame) {
+            StopTimer();
+            Finish();
+        }
+        return frame;
+    }
+
+    // Decodes whatever arrived since the last tick without waiting for more. Only the newest
+    // frame is shown; if even that one is too late, the queued packets up to the newest
+    // keyframe are skipped so the feed catches up.
+    void ProceedLive() {
+        PipelineStats& stats = PipelineStats::Instance();
+        bool latest = false;
+        while (const libav::AVFrame* frame = NextFrame([this]() { return m_media->demuxer->Ready(); })) {
+            if (latest)
+                ++stats.droppedFrames; // superseded before it was shown
+            latest = m_latency.Admit(frame->GetTimestamp());
+            if (latest) {
+                m_latest.Ref(*frame); // the decoder may already have let go of it when the loop ends
+            } else {
+                ++stats.droppedFrames;
+                stats.droppedPackets += m_media->demuxer->SkipToLatestKeyframe(m_media->stream->GetStreamIndexes()[0]);
+            }
+        }
+
+        if (latest) {
+            stats.liveLag.Add(std::chrono::milliseconds(m_latency.GetLastLag()));
+            m_position = m_latest.GetTimestamp();
+            m_frameReceiver.FeedFrame(&m_latest);
+        }
+        if (m_media->stream->IsEnded()) {
+            killTimer(m_timerId);
+            m_timerId = 0;
+            Finish();
+        }
+    }
+
+    // Spends most of a display refresh decoding; frames that are superseded within the
+    // same refresh are analysed but never converted or uploaded
+    void ProceedTurbo() {
+        QElapsedTimer budget;
+        budget.start();
+        bool latest = false;
+        const libav::AVFrame* frame = nullptr;
+        while (budget.elapsed() < kTurboBudget && (frame = NextFrame([]() { return true; }))) {
+            m_latest.Ref(*frame);
+            latest = true;
+        }
+
+        if (latest) {
+            m_position = m_latest.GetTimestamp();
+            m_frameReceiver.FeedFrame(&m_latest);
+        }
+        if (! frame) {
             killTimer(m_timerId);
             m_timerId = 0;
+            Finish();
         }
-        return decoded;
+    }
+
+    // End of the stream: the index is saved and the audio levels of the last moments completed
+    void Finish() {
+        if (AudioMeter* meter = m_analysis.GetAudioMeter())
+            meter->Finish();
+        MediaIndexBuilder* builder = m_analysis.GetIndexBuilder();
+        if (builder && builder->Save(m_media->fileName.c_str(), m_media->input->GetDuration()))
+            m_media->index = MediaIndex::Open(m_media->fileName.c_str());
+        m_analysis.EnableIndexing(false);
     }
 
 private:
-    MainWidget&           m_frameReceiver;
-    libav::AVInputFile    m_inputFile;
-    libav::AVStream       m_fileStream;
-    FrameCallbackHandler  m_callback;
-    int                   m_timerId;
+    IFrameSink&                   m_frameReceiver;
+    std::unique_ptr<OpenedMedia>  m_media;
+    FrameAnalysis                 m_analysis;
+    LatencyPolicy                 m_latency;
+    FrameCache                    m_frameCache;
+    FrameCache::Frame             m_shown;      // keeps a cached frame alive while it is on screen
+    libav::AVFrame                m_latest;     // newest frame of a live or turbo refresh
+    uint64_t                      m_position;
+    uint64_t                      m_skipUntil;  // milliseconds
+    bool                          m_turbo;
+    bool                          m_paused;
+    bool                          m_inSync;     // the decoder continues right after the frame on screen
+    bool                          m_previewPlayback; // plays in the decoder's preview profile, for scrubbing
+    int                           m_timerId;
 };
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "libav.h"
+
+// Receives the frames a FrameExtractor shows: MainWidget on screen, or an offscreen sink
+// when there is no display. The frame is only valid during the call.
+class IFrameSink
+{
+public:
+    virtual void FeedFrame(const libav::AVFrame* frame) = 0;
+
+protected:
+    virtual ~IFrameSink() { }
+};
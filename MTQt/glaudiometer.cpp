@@ -0,0 +1,97 @@
+#include "glaudiometer.h"
+
+#include "glplatform.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const double kFloorDb = -60.0;     // bottom of the bars, dBFS and LUFS alike
+static const double kTargetLufs = -23.0;  // EBU R128 programme loudness
+static const double kMaxTruePeak = -1.0;  // dBTP, EBU R128 maximum
+static const double kGap = 0.1;           // between the bars, in bar widths
+
+// -1 at the floor of the scale, 1 at full scale
+static double ToY(double db)
+{
+    if (std::isinf(db) || db < kFloorDb)
+        return -1.0;
+    return -1.0 + 2.0 * (std::min(db, 0.0) - kFloorDb) / -kFloorDb;
+}
+
+static void Quad(double left, double right, double bottom, double top)
+{
+    glVertex2d(left, bottom);
+    glVertex2d(right, bottom);
+    glVertex2d(right, top);
+    glVertex2d(left, top);
+}
+
+GLAudioMeter::GLAudioMeter(QWidget* parent)
+    : QGLWidget(parent)
+    , m_intervals(0)
+{
+}
+
+void GLAudioMeter::FeedLevels(const AudioMeter* meter)
+{
+    const uint64_t intervals = meter ? meter->GetIntervalCount() : 0;
+    if (intervals == m_intervals)
+        return;
+    m_intervals = intervals;
+    if (intervals)
+        m_interval = meter->GetLast();
+    update();
+}
+
+void GLAudioMeter::initializeGL()
+{
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glDisable(GL_DEPTH_TEST);
+}
+
+void GLAudioMeter::paintGL()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    if (! m_intervals)
+        return;
+
+    // The channels, then the loudness a bar further right
+    const size_t channels = m_interval.channels.size();
+    const double width = 2.0 / (channels + 1 + kGap * (channels + 1));
+    glBegin(GL_QUADS);
+    for (size_t c = 0; c < channels; ++c) {
+        const AudioChannelLevels& levels = m_interval.channels[c];
+        const double left = -1.0 + c * width * (1.0 + kGap), right = left + width;
+        const double rms = ToY(AudioMeter::ToDb(levels.rms));
+        const double peak = ToY(AudioMeter::ToDb(levels.peak));
+        const double truePeakDb = AudioMeter::ToDb(levels.truePeak);
+        const double truePeak = ToY(truePeakDb);
+
+        glColor3d(0.0, 0.6, 0.0);
+        Quad(left, right, -1.0, rms);
+        glColor3d(0.0, 0.3, 0.0);
+        Quad(left, right, rms, peak);
+        if (truePeakDb > kMaxTruePeak)
+            glColor3d(1.0, 0.0, 0.0);
+        else
+            glColor3d(1.0, 1.0, 1.0);
+        Quad(left, right, truePeak - 0.01, truePeak + 0.01);
+    }
+
+    const double left = 1.0 - width, target = ToY(kTargetLufs);
+    glColor3d(0.0, 0.4, 0.8);
+    Quad(left, 1.0, -1.0, ToY(m_interval.momentary));
+    glColor3d(1.0, 1.0, 0.0);
+    Quad(left, 1.0, target - 0.01, target + 0.01);
+    glEnd();
+}
+
+void GLAudioMeter::resizeGL(int width, int height)
+{
+    if (width == 0 || height == 0)
+        return;
+    glViewport(0, 0, width, height);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "audiometer.h"
+
+#include <QGLWidget>
+
+// Audio levels beside the scopes: a bar per channel with RMS, sample peak and true peak,
+// and one with the momentary loudness against the EBU R128 target
+class GLAudioMeter : public QGLWidget
+{
+    Q_OBJECT
+
+public:
+    explicit GLAudioMeter(QWidget* parent = nullptr);
+
+    virtual QSize sizeHint() const override { return QSize(64, 255); }
+    virtual QSize minimumSizeHint() const override { return sizeHint(); }
+
+    // Shows the last interval of `meter`; repaints only when it has completed a new one.
+    // nullptr, or a meter without intervals, clears the bars.
+    void FeedLevels(const AudioMeter* meter);
+
+private:
+    virtual void initializeGL() override;
+    virtual void paintGL() override;
+    virtual void resizeGL(int width, int height) override;
+
+    AudioInterval m_interval;
+    uint64_t m_intervals; // GetIntervalCount() of the meter when m_interval was taken
+};
@@ -0,0 +1,171 @@
+#include "glcanvas.h"
+
+#include <QDebug>
+#include <QVector4D>
+
+static const char* kYUVFragmentShader =
+    "uniform sampler2D planeY;\n"
+    "uniform sampler2D planeU;\n"
+    "uniform sampler2D planeV;\n"
+    "uniform float fullRange;\n"
+    "uniform vec4 yuvMatrix;\n"
+    "uniform float highlightIllegal;\n"
+    "void main() {\n"
+    "    float y = texture2D(planeY, gl_TexCoord[0].st).r;\n"
+    "    float u = texture2D(planeU, gl_TexCoord[0].st).r - 0.5;\n"
+    "    float v = texture2D(planeV, gl_TexCoord[0].st).r - 0.5;\n"
+    "    if (highlightIllegal > 0.5 && fullRange < 0.5) {\n"
+    "        bool illegal = y < 15.5 / 255.0 || y > 235.5 / 255.0\n"
+    "            || u < -112.0 / 255.0 || u > 113.0 / 255.0 || v < -112.0 / 255.0 || v > 113.0 / 255.0;\n"
+    "        if (illegal && mod(gl_FragCoord.x + gl_FragCoord.y, 8.0) < 4.0) {\n"
+    "            gl_FragColor = vec4(1.0, 0.0, 1.0, 1.0);\n"
+    "            return;\n"
+    "        }\n"
+    "    }\n"
+    "    if (fullRange < 0.5) {\n"
+    "        y = (y - 16.0 / 255.0) * (255.0 / 219.0);\n"
+    "        u *= 255.0 / 224.0;\n"
+    "        v *= 255.0 / 224.0;\n"
+    "    }\n"
+    "    gl_FragColor = vec4(y + yuvMatrix.x * v, y - yuvMatrix.y * u - yuvMatrix.z * v, y + yuvMatrix.w * u, 1.0);\n"
+    "}\n";
+
+QGLCanvas::QGLCanvas(QWidget* parent, const QGLWidget* shareWidget)
+    : QGLWidget(parent, shareWidget)
+    , m_frame(nullptr)
+    , m_serial(0)
+    , m_uploadedSerial(0)
+    , m_initialized(false)
+    , m_uploaded(false)
+    , m_highlightIllegal(false)
+{
+}
+
+void QGLCanvas::SetHighlightIllegal(bool highlight)
+{
+    m_highlightIllegal = highlight;
+    update();
+}
+
+QGLCanvas::~QGLCanvas()
+{
+    makeCurrent();
+    m_planes.Release();
+}
+
+uint64_t QGLCanvas::FeedFrame(const libav::AVFrame* frame)
+{
+    m_frame = frame;
+    ++m_serial;
+    m_uploaded = false;
+
+    // Upload right away: the frame is only valid until the next decode call
+    if (m_initialized && m_frame) {
+        makeCurrent();
+        Upload();
+    }
+    update();
+    return m_serial;
+}
+
+const GLPlaneStream* QGLCanvas::GetPlanes(uint64_t serial) const
+{
+    return serial && serial == m_uploadedSerial && m_planes.IsYUV() ? &m_planes : nullptr;
+}
+
+void QGLCanvas::initializeGL()
+{
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glDisable(GL_DEPTH_TEST);
+
+    if (QGLShaderProgram::hasOpenGLShaderPrograms(context())) {
+        if (! m_yuvShader.addShaderFromSourceCode(QGLShader::Fragment, kYUVFragmentShader) || ! m_yuvShader.link())
+            qDebug() << "YUV shader unavailable, falling back to RGB conversion:" << m_yuvShader.log();
+    }
+    m_initialized = true;
+}
+
+void QGLCanvas::Upload()
+{
+    const ::PixelFormat format = static_cast< ::PixelFormat>(m_frame->GetRaw()->format);
+    if (m_yuvShader.isLinked() && GLPlaneStream::IsSupported(format)) {
+        m_uploaded = m_planes.Upload(*m_frame);
+    } else {
+        // Reuse the RGB picture while the size stays the same
+        if (m_tempFrame && m_tempFrame->GetWidth() == m_frame->GetWidth() && m_tempFrame->GetHeight() == m_frame->GetHeight()) {
+            m_tempFrame->ConvertFrom(*m_frame);
+        } else {
+            libav::AVImageFormat imageFormat(m_frame->GetWidth(), m_frame->GetHeight(), PIX_FMT_RGB24);
+            m_tempFrame.reset(new libav::AVTempFrame(imageFormat, *m_frame));
+        }
+        m_uploaded = m_planes.Upload(*m_tempFrame);
+    }
+    m_uploadedSerial = m_uploaded ? m_serial : 0;
+    if (m_uploaded && isSharing())
+        m_planes.Fence(); // for the scopes, which sample the planes from their own contexts
+}
+
+void QGLCanvas::paintGL()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    if (! m_frame)
+        return;
+    if (! m_uploaded)
+        Upload();
+    if (! m_uploaded)
+        return;
+
+    const bool yuv = m_planes.IsYUV();
+    if (yuv) {
+        for (unsigned i = 0; i < m_planes.GetPlaneCount(); ++i) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, m_planes.GetTexture(i));
+        }
+        glActiveTexture(GL_TEXTURE0);
+        m_yuvShader.bind();
+        m_yuvShader.setUniformValue("planeY", 0);
+        m_yuvShader.setUniformValue("planeU", 1);
+        m_yuvShader.setUniformValue("planeV", 2);
+        m_yuvShader.setUniformValue("fullRange", m_planes.IsFullRange() ? 1.0f : 0.0f);
+        // Cr to red, Cb and Cr to green, Cb to blue, as in YuvConvert::MakeCoefficients
+        double kr, kb;
+        YuvConvert::GetWeights(m_planes.GetMatrix(), kr, kb);
+        const double kg = 1.0 - kr - kb;
+        m_yuvShader.setUniformValue("yuvMatrix", QVector4D(2.0 * (1.0 - kr), 2.0 * (1.0 - kb) * kb / kg,
+                                                        2.0 * (1.0 - kr) * kr / kg, 2.0 * (1.0 - kb)));
+        m_yuvShader.setUniformValue("highlightIllegal", m_highlightIllegal ? 1.0f : 0.0f);
+    } else {
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, m_planes.GetTexture(0));
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    }
+
+    // The first uploaded row is the top of the picture
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 1.0); glVertex2f(-1.0, -1.0);
+    glTexCoord2f(1.0, 1.0); glVertex2f( 1.0, -1.0);
+    glTexCoord2f(1.0, 0.0); glVertex2f( 1.0,  1.0);
+    glTexCoord2f(0.0, 0.0); glVertex2f(-1.0,  1.0);
+    glEnd();
+
+    if (yuv) {
+        m_yuvShader.release();
+        for (unsigned i = m_planes.GetPlaneCount(); i-- > 0; ) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    } else {
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_TEXTURE_2D);
+    }
+}
+
+void QGLCanvas::resizeGL(int width, int height)
+{
+    if (width == 0 || height == 0)
+        return;
+    glViewport(0, 0, width, height);
+}
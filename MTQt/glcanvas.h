@@ -1,50 +1,48 @@
 #pragma once
 
+#include "glplanestream.h"
 #include "libav.h"
 
+#include <QGLShaderProgram>
 #include <QGLWidget>
-#include <QImage>
-#include <QPaintEvent>
-#include <QPainter>
 #include <QWidget>
 
-#include <QDebug>
-
 #include <memory>
 
 class QGLCanvas : public QGLWidget
 {
 public:
-    QGLCanvas(QWidget* parent = nullptr) : QGLWidget(parent), m_frame(nullptr)
-    { }
-
-    void FeedFrame(const libav::AVFrame* frame)
-    {
-        m_frame = frame;
-        update();
-    }
+    // Canvases and scopes pass the first canvas as `shareWidget`, so that they all are in one
+    // share group and the planes are uploaded once per frame
+    QGLCanvas(QWidget* parent = nullptr, const QGLWidget* shareWidget = nullptr);
+    ~QGLCanvas();
+
+    // Returns the serial number of the frame on display, never 0
+    uint64_t FeedFrame(const libav::AVFrame* frame);
+    // Zebra stripes over levels outside the limited range, YUV shader path only
+    void SetHighlightIllegal(bool highlight);
+    bool GetHighlightIllegal() const { return m_highlightIllegal; }
+    // The plane textures while the frame FeedFrame() numbered `serial` is on display and went
+    // up as YUV planes, otherwise nullptr. Widgets in the canvas's share group sample them
+    // instead of uploading again. Frames are told apart by serial rather than address, since
+    // the extractors show every frame of a refresh through the same AVFrame.
+    const GLPlaneStream* GetPlanes(uint64_t serial) const;
 
 private:
-    virtual void paintEvent(QPaintEvent* paintEvent) override
-    {
-        if (! m_frame)
-            return;
-
-        // ::PixelFormat pixelFormat = AV_PIX_FMT_RGB32;
-        ::PixelFormat pixelFormat = PIX_FMT_RGB24;
-        libav::AVImageFormat imageFormat(m_frame->GetWidth(), m_frame->GetHeight(), pixelFormat);
-
-        m_tempFrame.reset(new libav::AVTempFrame(imageFormat, *m_frame));
-        m_image = QImage(m_tempFrame->GetPlane(0), m_tempFrame->GetWidth(), m_tempFrame->GetHeight(),
-                         QImage::Format_RGB888);
+    virtual void initializeGL() override;
+    virtual void paintGL() override;
+    virtual void resizeGL(int width, int height) override;
 
-        QPainter p(this);
-        p.setRenderHint(QPainter::SmoothPixmapTransform, true);
-        p.drawImage(rect(), m_image);
-    }
+    void Upload();
 
 private:
     const libav::AVFrame* m_frame;
+    uint64_t m_serial;         // of m_frame
+    uint64_t m_uploadedSerial; // of the frame in the textures
     std::unique_ptr<libav::AVTempFrame> m_tempFrame;
-    QImage m_image;
+    GLPlaneStream m_planes;
+    QGLShaderProgram m_yuvShader;
+    bool m_initialized;
+    bool m_uploaded;
+    bool m_highlightIllegal;
 };
@@ -0,0 +1,233 @@
+#include "glplanestream.h"
+#include "pipelinestats.h"
+
+#include <cstdio>
+#include <cstring>
+
+static bool HasPixelBufferObjects()
+{
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    int major = 0, minor = 0;
+    if (version && std::sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 2 || (major == 2 && minor >= 1)))
+        return true;
+    const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    return extensions && std::strstr(extensions, "GL_ARB_pixel_buffer_object");
+}
+
+static bool HasSyncObjects()
+{
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    int major = 0, minor = 0;
+    if (version && std::sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 3 || (major == 3 && minor >= 2)))
+        return true;
+    const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    return extensions && std::strstr(extensions, "GL_ARB_sync");
+}
+
+GLPlaneStream::GLPlaneStream(unsigned ringSize)
+    : m_ringSize(std::max(ringSize, 1u))
+    , m_nextPbo(0)
+    , m_usePbo(false)
+    , m_planeCount(0)
+    , m_glFormat(GL_LUMINANCE)
+    , m_format(PIX_FMT_NONE)
+    , m_matrix(YuvConvert::MATRIX_BT601)
+    , m_fullRange(false)
+    , m_reallocate(true)
+    , m_useSync(false)
+    , m_fence(nullptr)
+{
+    memset(m_planes, 0, sizeof(m_planes));
+}
+
+GLPlaneStream::~GLPlaneStream()
+{
+    Release();
+}
+
+bool GLPlaneStream::IsSupported(::PixelFormat format)
+{
+    switch (format) {
+        case PIX_FMT_YUV420P:
+        case PIX_FMT_YUVJ420P:
+        case PIX_FMT_YUV422P:
+        case PIX_FMT_YUVJ422P:
+        case PIX_FMT_YUV444P:
+        case PIX_FMT_YUVJ444P:
+        case PIX_FMT_RGB24:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void GLPlaneStream::Release()
+{
+    for (unsigned i = 0; i < m_planeCount; ++i) {
+        if (m_planes[i].texture)
+            glDeleteTextures(1, &m_planes[i].texture);
+        m_planes[i].texture = 0;
+    }
+    if (! m_pbos.empty())
+        glDeleteBuffers(m_pbos.size(), m_pbos.data());
+    m_pbos.clear();
+    if (m_fence)
+        glDeleteSync(m_fence);
+    m_fence = nullptr;
+    m_planeCount = 0;
+    m_format = PIX_FMT_NONE;
+    m_reallocate = true;
+}
+
+bool GLPlaneStream::Layout(const libav::AVFrame& frame)
+{
+    const ::PixelFormat format = static_cast< ::PixelFormat>(frame.GetRaw()->format);
+    if (! IsSupported(format))
+        return false;
+
+    const unsigned width = frame.GetWidth();
+    const unsigned height = frame.GetHeight();
+    if (format == m_format && width == GetWidth() && height == GetHeight())
+        return true;
+
+    unsigned chromaWidth = width, chromaHeight = height;
+    if (format == PIX_FMT_YUV420P || format == PIX_FMT_YUVJ420P) {
+        chromaWidth = (width + 1) / 2;
+        chromaHeight = (height + 1) / 2;
+    } else if (format == PIX_FMT_YUV422P || format == PIX_FMT_YUVJ422P) {
+        chromaWidth = (width + 1) / 2;
+    }
+
+    for (unsigned i = 0; i < m_planeCount; ++i)
+        glDeleteTextures(1, &m_planes[i].texture);
+
+    if (format == PIX_FMT_RGB24) {
+        m_planeCount = 1;
+        m_glFormat = GL_RGB;
+        m_planes[0].width = width;
+        m_planes[0].height = height;
+        m_planes[0].lineSize = width * 3;
+    } else {
+        m_planeCount = MAX_PLANES;
+        m_glFormat = GL_LUMINANCE;
+        for (unsigned i = 0; i < m_planeCount; ++i) {
+            m_planes[i].width = i ? chromaWidth : width;
+            m_planes[i].height = i ? chromaHeight : height;
+            m_planes[i].lineSize = m_planes[i].width;
+        }
+    }
+
+    size_t offset = 0;
+    for (unsigned i = 0; i < m_planeCount; ++i) {
+        m_planes[i].offset = offset;
+        offset += m_planes[i].lineSize * m_planes[i].height;
+    }
+
+    m_format = format;
+    m_reallocate = true;
+    return true;
+}
+
+void GLPlaneStream::AllocTextures()
+{
+    for (unsigned i = 0; i < m_planeCount; ++i) {
+        Plane& p = m_planes[i];
+        glGenTextures(1, &p.texture);
+        glBindTexture(GL_TEXTURE_2D, p.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, m_glFormat, p.width, p.height, 0, m_glFormat, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_reallocate = false;
+}
+
+size_t GLPlaneStream::UploadSize() const
+{
+    const Plane& last = m_planes[m_planeCount - 1];
+    return last.offset + last.lineSize * last.height;
+}
+
+bool GLPlaneStream::Upload(const libav::AVFrame& frame)
+{
+    StageTimer::Scope timing(PipelineStats::Instance().upload);
+
+    if (! Layout(frame))
+        return false;
+    // Tags may change without the layout, the shader takes them per frame
+    m_matrix = YuvConvert::GetMatrix(*frame.GetRaw());
+    m_fullRange = YuvConvert::IsFullRange(*frame.GetRaw());
+
+    if (m_pbos.empty()) {
+        m_usePbo = HasPixelBufferObjects();
+        if (m_usePbo) {
+            m_pbos.resize(m_ringSize);
+            glGenBuffers(m_pbos.size(), m_pbos.data());
+        }
+    }
+    if (m_reallocate) {
+        AllocTextures();
+        m_useSync = HasSyncObjects();
+    }
+
+    // Pack the planes tightly; the decoder's line sizes include padding
+    const size_t size = UploadSize();
+    uint8_t* dst = nullptr;
+    std::vector<uint8_t> scratch;
+    if (m_usePbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[m_nextPbo]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW); // orphan
+        dst = static_cast<uint8_t*>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
+        m_nextPbo = (m_nextPbo + 1) % m_pbos.size();
+    }
+    if (! dst) {
+        scratch.resize(size);
+        dst = scratch.data();
+    }
+
+    for (unsigned i = 0; i < m_planeCount; ++i) {
+        const Plane& p = m_planes[i];
+        const uint8_t* src = frame.GetPlane(i);
+        for (unsigned y = 0; y < p.height; ++y)
+            memcpy(dst + p.offset + y * p.lineSize, src + y * frame.GetLineSize(i), p.lineSize);
+    }
+
+    if (scratch.empty())
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    else if (m_usePbo)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // mapping failed, upload from client memory
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (unsigned i = 0; i < m_planeCount; ++i) {
+        const Plane& p = m_planes[i];
+        const void* pixels = scratch.empty() ? reinterpret_cast<const void*>(p.offset) : scratch.data() + p.offset;
+        glBindTexture(GL_TEXTURE_2D, p.texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, p.width, p.height, m_glFormat, GL_UNSIGNED_BYTE, pixels);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (m_usePbo)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return true;
+}
+
+void GLPlaneStream::Fence()
+{
+    if (m_fence)
+        glDeleteSync(m_fence);
+    m_fence = nullptr;
+    if (! m_useSync) {
+        glFinish();
+        return;
+    }
+    m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush(); // a context can only wait for a fence that has been submitted
+}
+
+void GLPlaneStream::WaitFence() const
+{
+    if (m_fence)
+        glWaitSync(m_fence, 0, GL_TIMEOUT_IGNORED);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "glplatform.h"
+#include "libav.h"
+
+#include <vector>
+
+// Streams the planes of decoded frames into textures through a ring of
+// pixel buffer objects. Every upload orphans the next buffer of the ring,
+// so filling it never waits for a transfer the driver has not finished.
+// The frame goes on screen right away, so its copy into the buffer and
+// its transfer to the textures still run one after the other; the buffer
+// only spares the driver a copy of client memory.
+// All methods require the owning GL context to be current.
+class GLPlaneStream : NoCopy
+{
+public:
+    static const unsigned MAX_PLANES = 3;
+
+    explicit GLPlaneStream(unsigned ringSize = 2);
+    ~GLPlaneStream();
+
+    static bool IsSupported(::PixelFormat format);
+
+    bool Upload(const libav::AVFrame& frame);
+    void Release();
+
+    // Other contexts of the share group read the textures only after the upload has
+    // completed: the uploading context calls Fence(), the reading one WaitFence() before
+    // it samples. Where the GL lacks sync objects, Fence() waits for the GPU itself.
+    void Fence();
+    void WaitFence() const;
+
+    bool IsYUV() const { return m_planeCount == MAX_PLANES; }
+    bool IsFullRange() const { return m_fullRange; }
+    YuvConvert::Matrix GetMatrix() const { return m_matrix; }
+    unsigned GetPlaneCount() const { return m_planeCount; }
+    GLuint GetTexture(unsigned idx) const { assert(idx < m_planeCount); return m_planes[idx].texture; }
+    uint32_t GetWidth() const { return m_planeCount ? m_planes[0].width : 0; }
+    uint32_t GetHeight() const { return m_planeCount ? m_planes[0].height : 0; }
+    unsigned GetPlaneWidth(unsigned idx) const { assert(idx < m_planeCount); return m_planes[idx].width; }
+    unsigned GetPlaneHeight(unsigned idx) const { assert(idx < m_planeCount); return m_planes[idx].height; }
+    ::PixelFormat GetFormat() const { return m_format; }
+
+private:
+    struct Plane {
+        GLuint    texture;
+        unsigned  width;
+        unsigned  height;
+        unsigned  lineSize;
+        size_t    offset;
+    };
+
+    bool Layout(const libav::AVFrame& frame);
+    void AllocTextures();
+    size_t UploadSize() const;
+
+private:
+    const unsigned       m_ringSize;
+    std::vector<GLuint>  m_pbos;
+    unsigned             m_nextPbo;
+    bool                 m_usePbo;
+
+    Plane          m_planes[MAX_PLANES];
+    unsigned       m_planeCount;
+    GLenum         m_glFormat;
+    ::PixelFormat  m_format;
+    YuvConvert::Matrix  m_matrix;
+    bool           m_fullRange;
+    bool           m_reallocate;
+    bool           m_useSync;
+    GLsync         m_fence;   // after the last upload, nullptr without sync objects
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+// OpenGL 2.1 entry points (buffer objects, shaders) without an extension loader
+
+#ifdef __APPLE__
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
@@ -0,0 +1,147 @@
+#include "glscope.h"
+
+#include <QGLFormat>
+
+#include <algorithm>
+
+// One point per luma sample: column x of the source at x, the level as the height
+static const char* kWaveformVertexShader =
+    "#version 130\n"
+    "uniform sampler2D planeY;\n"
+    "uniform int width;\n"
+    "void main() {\n"
+    "    ivec2 texel = ivec2(gl_VertexID % width, gl_VertexID / width);\n"
+    "    float luma = texelFetch(planeY, texel, 0).r;\n"
+    "    gl_Position = vec4((float(texel.x) + 0.5) * 2.0 / float(width) - 1.0,\n"
+    "                       (luma * 255.0 + 0.5) * 2.0 / 256.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+// One point per chroma sample: U left to right, V bottom to top
+static const char* kVectorscopeVertexShader =
+    "#version 130\n"
+    "uniform sampler2D planeU;\n"
+    "uniform sampler2D planeV;\n"
+    "uniform int width;\n"
+    "void main() {\n"
+    "    ivec2 texel = ivec2(gl_VertexID % width, gl_VertexID / width);\n"
+    "    vec2 uv = vec2(texelFetch(planeU, texel, 0).r, texelFetch(planeV, texel, 0).r);\n"
+    "    gl_Position = vec4((uv * 255.0 + 0.5) * 2.0 / 256.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* kAccumulateFragmentShader =
+    "#version 130\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(1.0);\n"
+    "}\n";
+
+static const char* kToneMapFragmentShader =
+    "uniform sampler2D hits;\n"
+    "uniform float gain;\n"
+    "void main() {\n"
+    "    float level = 1.0 - exp(-gain * texture2D(hits, gl_TexCoord[0].st).r);\n"
+    "    gl_FragColor = vec4(0.25 * level, level, 0.25 * level, 1.0);\n"
+    "}\n";
+
+static bool Build(QGLShaderProgram& program, const char* vertexShader, const char* fragmentShader)
+{
+    return (! vertexShader || program.addShaderFromSourceCode(QGLShader::Vertex, vertexShader))
+        && program.addShaderFromSourceCode(QGLShader::Fragment, fragmentShader)
+        && program.link();
+}
+
+GLScope::GLScope()
+    : m_ready(false)
+{
+}
+
+bool GLScope::Init(const QGLContext* context)
+{
+    if (! (QGLFormat::openGLVersionFlags() & QGLFormat::OpenGL_Version_3_0)
+        || ! QGLShaderProgram::hasOpenGLShaderPrograms(context)
+        || ! QGLFramebufferObject::hasOpenGLFramebufferObjects())
+        return false;
+
+    GLint vertexTextureUnits = 0;
+    glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertexTextureUnits);
+    if (vertexTextureUnits < 2)
+        return false;
+
+    m_ready = Build(m_waveform, kWaveformVertexShader, kAccumulateFragmentShader)
+        && Build(m_vectorscope, kVectorscopeVertexShader, kAccumulateFragmentShader)
+        && Build(m_toneMap, nullptr, kToneMapFragmentShader);
+    return m_ready;
+}
+
+bool GLScope::Render(bool vectorscope, const GLPlaneStream& planes, int viewportWidth, int viewportHeight)
+{
+    if (! m_ready || ! planes.IsYUV() || viewportWidth <= 0 || viewportHeight <= 0)
+        return false;
+
+    const QSize size(viewportWidth, viewportHeight);
+    if (! m_hits || m_hits->size() != size) {
+        m_hits.reset(new QGLFramebufferObject(size, QGLFramebufferObject::NoAttachment, GL_TEXTURE_2D, GL_RGBA32F_ARB));
+        if (! m_hits->isValid()) {
+            m_hits.reset();
+            m_ready = false;
+            return false;
+        }
+    }
+
+    planes.WaitFence();
+    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_ENABLE_BIT | GL_VIEWPORT_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    // Count: every sample adds one to the pixel it lands on
+    const unsigned plane = vectorscope ? 1 : 0;
+    const unsigned width = planes.GetPlaneWidth(plane), height = planes.GetPlaneHeight(plane);
+    m_hits->bind();
+    glViewport(0, 0, viewportWidth, viewportHeight);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    QGLShaderProgram& accumulate = vectorscope ? m_vectorscope : m_waveform;
+    accumulate.bind();
+    if (vectorscope) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, planes.GetTexture(2));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, planes.GetTexture(1));
+        accumulate.setUniformValue("planeU", 0);
+        accumulate.setUniformValue("planeV", 1);
+    } else {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, planes.GetTexture(0));
+        accumulate.setUniformValue("planeY", 0);
+    }
+    accumulate.setUniformValue("width", int(width));
+    glDrawArrays(GL_POINTS, 0, GLsizei(width * height));
+    accumulate.release();
+    if (vectorscope) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    m_hits->release();
+
+    // The tone map of ScopeRenderer::Composite
+    const double samples = double(width) * height;
+    const double average = std::max(1.0, samples / (vectorscope ? 0.1 * viewportWidth * viewportHeight : viewportWidth * 32.0));
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_2D, m_hits->texture());
+    m_toneMap.bind();
+    m_toneMap.setUniformValue("hits", 0);
+    m_toneMap.setUniformValue("gain", GLfloat(2.0 / average));
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 0.0); glVertex2f(-1.0, -1.0);
+    glTexCoord2f(1.0, 0.0); glVertex2f( 1.0, -1.0);
+    glTexCoord2f(1.0, 1.0); glVertex2f( 1.0,  1.0);
+    glTexCoord2f(0.0, 1.0); glVertex2f(-1.0,  1.0);
+    glEnd();
+    m_toneMap.release();
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glPopAttrib();
+    return true;
+}
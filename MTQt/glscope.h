@@ -0,0 +1,38 @@
+#pragma once
+
+#include "glplanestream.h"
+#include "glplatform.h"
+#include "libav.h"
+
+#include <QGLFramebufferObject>
+#include <QGLShaderProgram>
+
+#include <memory>
+
+// Draws the waveform or the vectorscope entirely on the GPU from plane textures that are
+// already uploaded for display, in a context that shares them. A single draw call without
+// vertex data emits one point per sample; the vertex shader fetches the sample by
+// gl_VertexID and places it at (x, Y) or (U, V). Additive blending counts the hits per
+// pixel in a float framebuffer, which is then tone mapped to the same phosphor green as
+// ScopeRenderer.
+// Needs OpenGL 3.0 (GLSL 1.30, float render targets) with vertex texture fetch. All
+// methods require the owning GL context to be current.
+class GLScope : NoCopy
+{
+public:
+    GLScope();
+
+    // Builds the shaders; false if the context lacks any of the required features
+    bool Init(const QGLContext* context);
+    bool IsReady() const { return m_ready; }
+
+    // Draws the scope of the YUV `planes` over the current viewport
+    bool Render(bool vectorscope, const GLPlaneStream& planes, int viewportWidth, int viewportHeight);
+
+private:
+    QGLShaderProgram                       m_waveform;
+    QGLShaderProgram                       m_vectorscope;
+    QGLShaderProgram                       m_toneMap;
+    std::unique_ptr<QGLFramebufferObject>  m_hits;
+    bool                                   m_ready;
+};
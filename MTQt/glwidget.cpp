@@ -1,28 +1,81 @@
 #include "glwidget.h"
+#include "glcanvas.h"
+#include "glscope.h"
 
 #include <OpenGL/glu.h>
 
-#include <QDebug>
 #include <QImage>
+#include <QTimer>
 
 #include <algorithm>
+#include <cstddef>
 
 static inline uint8_t GetY(int x, int y, const libav::AVFrame *f)
 {
     return f->GetPlane(0)[ (y * f->GetLineSize(0)) + x ];
 }
 
-GLWidget::GLWidget(bool vectorscope, QWidget* parent)
-    : QGLWidget(parent)
+GLWidget::GLWidget(bool vectorscope, QWidget* parent, QGLCanvas* canvas)
+    : QGLWidget(parent, canvas)
     , m_mode(MODE_DOTS)
     , m_frame(nullptr)
+    , m_canvasSerial(0)
     , m_vectorscope(vectorscope)
+    , m_vbo(0)
+    , m_geometryDirty(true)
+    , m_primitive(GL_POINTS)
+    , m_canvas(canvas)
+    , m_scopeUploaded(false)
+    , m_viewportWidth(0)
+    , m_viewportHeight(0)
+    , m_updatePending(false)
 {
 }
 
-void GLWidget::FeedFrame(const libav::AVFrame* frame)
+GLWidget::~GLWidget()
+{
+    if (m_vbo) {
+        makeCurrent();
+        m_gpuScope.reset();
+        m_scopePicture.Release();
+        glDeleteBuffers(1, &m_vbo);
+    }
+}
+
+void GLWidget::FeedFrame(const libav::AVFrame* frame, uint64_t canvasSerial)
 {
     m_frame = frame;
+    m_canvasSerial = canvasSerial;
+    m_geometryDirty = true;
+    RequestUpdate();
+}
+
+void GLWidget::FeedScope(const libav::AVTempFrame* scope)
+{
+    m_scopeUploaded = false;
+    if (scope && m_vbo) {
+        makeCurrent();
+        m_scopeUploaded = m_scopePicture.Upload(*scope);
+    }
+    RequestUpdate();
+}
+
+// Several frames or key presses within one refresh interval result in a single repaint
+void GLWidget::RequestUpdate()
+{
+    static const qint64 kRefreshIntervalMs = 1000 / 60;
+
+    if (m_updatePending)
+        return;
+    m_updatePending = true;
+
+    const qint64 sinceLastPaint = m_lastPaint.isValid() ? m_lastPaint.elapsed() : kRefreshIntervalMs;
+    QTimer::singleShot(std::max<qint64>(0, kRefreshIntervalMs - sinceLastPaint), this, SLOT(FlushUpdate()));
+}
+
+void GLWidget::FlushUpdate()
+{
+    m_updatePending = false;
     update();
 }
 
@@ -35,10 +88,20 @@ void GLWidget::initializeGL()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glClearColor(0.0,0.0,0.0,0.0);
+    glGenBuffers(1, &m_vbo);
+    m_geometryDirty = true;
+
+    if (m_canvas && isSharing()) {
+        m_gpuScope.reset(new GLScope());
+        if (! m_gpuScope->Init(context()))
+            m_gpuScope.reset(); // drawn on the CPU
+    }
 }
 
 void GLWidget::paintGL()
 {
+    m_lastPaint.restart();
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
@@ -46,13 +109,98 @@ void GLWidget::paintGL()
     if (m_frame == nullptr) {
         return;
     }
+    if (m_scopeUploaded) {
+        DrawScopePicture();
+        return;
+    }
+
+    // The GPU plots the dots straight from the canvas's textures, no geometry is built
+    if (m_mode == MODE_DOTS && m_gpuScope) {
+        const GLPlaneStream* planes = m_canvas->GetPlanes(m_canvasSerial);
+        if (planes && m_gpuScope->Render(m_vectorscope, *planes, m_viewportWidth, m_viewportHeight))
+            return;
+        if (! m_gpuScope->IsReady())
+            m_gpuScope.reset();
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    if (m_geometryDirty)
+        BuildGeometry();
+
+    // Repaints of an unchanged frame (resize, expose) only replay the buffer
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, x)));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, r)));
+    glMultiDrawArrays(m_primitive, m_firsts.data(), m_counts.data(), m_counts.size());
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GLWidget::DrawScopePicture()
+{
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, m_scopePicture.GetTexture(0));
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+    // The first row of the picture is the top of the scope
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 1.0); glVertex2f(-1.0, -1.0);
+    glTexCoord2f(1.0, 1.0); glVertex2f( 1.0, -1.0);
+    glTexCoord2f(1.0, 0.0); glVertex2f( 1.0,  1.0);
+    glTexCoord2f(0.0, 0.0); glVertex2f(-1.0,  1.0);
+    glEnd();
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+}
+
+void GLWidget::BuildGeometry()
+{
+    m_vertices.clear();
+    m_firsts.clear();
+    m_counts.clear();
+
+    if (m_vectorscope)
+        BuildVectorscope();
+    else
+        BuildWaveform();
+
+    glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex), m_vertices.data(), GL_STATIC_DRAW);
+    m_geometryDirty = false;
+}
+
+static const double kLeft = -1.0;
+static const double kRight = 1.0;
+static const double kBottom = -1.0;
+static const double kTop = 1.0;
+
+static inline GLubyte ToByte(double value)
+{
+    return static_cast<GLubyte>(std::min(std::max(value, 0.0), 1.0) * 255.0 + 0.5);
+}
+
+void GLWidget::BuildVectorscope()
+{
+    const double xScale = (kRight - kLeft) / 255.0;
+    const double yScale = (kTop - kBottom) / 255.0;
+
+    const uint8_t* u = m_frame->GetPlane(1);
+    const uint8_t* v = m_frame->GetPlane(2);
+    for(size_t t = 0; t < m_frame->GetLineSize(1); ++t) {
+        const Vertex vertex = { GLfloat(kLeft + u[t] * xScale), GLfloat(kBottom + v[t] * yScale), 0.0f, 0, 255, 0, 255 };
+        m_vertices.push_back(vertex);
+    }
 
-    static const double kLeft = -1.0;
-    static const double kRight = 1.0;
-    static const double kBottom = -1.0;
-    static const double kTop = 1.0;
+    m_primitive = GL_POINTS;
+    m_firsts.push_back(0);
+    m_counts.push_back(m_vertices.size());
+}
 
-    const double xScale = (kRight - kLeft) / (m_vectorscope ? 255.0 : m_frame->GetWidth());
+void GLWidget::BuildWaveform()
+{
+    const double xScale = (kRight - kLeft) / m_frame->GetWidth();
     const double yScale = (kTop - kBottom) / 255.0;
 
     const double colorStep = (m_mode == MODE_LINES_INCREASING_BRIGHTNESS)
@@ -61,45 +209,34 @@ void GLWidget::paintGL()
     double greenValue = 0.0;
     double z = -0.2;
 
-    if (m_vectorscope) {
-        const uint8_t* u = m_frame->GetPlane(1);
-        const uint8_t* v = m_frame->GetPlane(2);
-        for(size_t t = 0; t < m_frame->GetLineSize(1); ++t) {
-            glBegin(GL_POINTS);
-            double plotX = kLeft + u[t] * xScale;
-            double plotY = kBottom + v[t] * yScale;
-            glColor3f(0.0, 1.0, 0.0);
-            glVertex3f(plotX, plotY, 0.0);
-            glEnd();
-        }
-        return;
-    }
+    m_vertices.reserve((m_frame->GetWidth() + 1) * m_frame->GetHeight());
+    m_primitive = (m_mode == MODE_DOTS) ? GL_POINTS : GL_LINES;
 
     for (size_t y = 0; y < m_frame->GetHeight(); ++y, greenValue += colorStep, z += 0.01) {
-        glBegin( m_mode == MODE_DOTS ? GL_POINTS : GL_LINES );
-        glVertex3f(kLeft, 0.0, 0.0);
+        Vertex vertex = { GLfloat(kLeft), 0.0f, 0.0f, 0, 255, 0, 255 };
+        switch (m_mode) {
+            case MODE_DOTS:
+            case MODE_LINES:
+                break;
+            case MODE_LINES_INCREASING_BRIGHTNESS:
+                vertex.g = ToByte(greenValue);
+                break;
+            case MODE_LINES_ALPHA:
+                vertex.a = ToByte(z);
+                break;
+            default:
+                Q_ASSERT(0);
+        }
+
+        m_firsts.push_back(m_vertices.size());
+        m_vertices.push_back(vertex);
         for (size_t x = 0; x < m_frame->GetWidth(); ++x) {
-            double plotX = kLeft + x * xScale;
-            double plotY = kBottom + GetY(x, y, m_frame) * yScale;
-
-            switch (m_mode) {
-                case MODE_DOTS:
-                case MODE_LINES:
-                    glColor3f(0.0, 1.0, 0.0);
-                    break;
-                case MODE_LINES_INCREASING_BRIGHTNESS:
-                    glColor3f(0.0, greenValue, 0.0);
-                    break;
-                case MODE_LINES_ALPHA:
-                    glColor4f(0.0, 1.0, 0.0, z);
-                    break;
-                default:
-                    Q_ASSERT(0);
-            }
-
-            glVertex3f(plotX, plotY, m_mode == MODE_LINES_ALPHA ? z : 0.0);
+            vertex.x = kLeft + x * xScale;
+            vertex.y = kBottom + GetY(x, y, m_frame) * yScale;
+            vertex.z = m_mode == MODE_LINES_ALPHA ? z : 0.0;
+            m_vertices.push_back(vertex);
         }
-        glEnd();
+        m_counts.push_back(m_vertices.size() - m_firsts.back());
     }
 }
 
@@ -108,6 +245,8 @@ void GLWidget::resizeGL(int width, int height)
     if (width == 0 || height == 0)
         return;
     glViewport(0, 0, width, height);
+    m_viewportWidth = width;
+    m_viewportHeight = height;
 }
 
 void GLWidget::keyPressEvent(QKeyEvent* keyEvent)
@@ -127,5 +266,6 @@ void GLWidget::keyPressEvent(QKeyEvent* keyEvent)
     }
 
     QGLWidget::keyPressEvent(keyEvent);
-    update();
+    m_geometryDirty = true;
+    RequestUpdate();
 }
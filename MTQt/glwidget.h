@@ -2,21 +2,40 @@
 
 #include "libav.h"
 
+#include "glplanestream.h"
+#include "glplatform.h"
+
+#include <QElapsedTimer>
 #include <QGLWidget>
 #include <QKeyEvent>
 
+#include <memory>
+#include <vector>
+
+class GLScope;
+class QGLCanvas;
 
 class GLWidget : public QGLWidget
 {
     Q_OBJECT
 
 public:
-    explicit GLWidget(bool vectorscope, QWidget* parent = nullptr);
+    // With a `canvas` the widget joins its share group, and the dots are drawn on the GPU
+    // from the planes the canvas has uploaded, where the GL supports it
+    explicit GLWidget(bool vectorscope, QWidget* parent = nullptr, QGLCanvas* canvas = nullptr);
+    ~GLWidget();
 
     virtual QSize sizeHint() const override { return QSize(255, 255); }
     virtual QSize minimumSizeHint() const override { return sizeHint(); }
 
-    void FeedFrame(const libav::AVFrame* frame);
+    // `canvasSerial`: what the canvas returned from FeedFrame() if it shows this very frame, else 0
+    void FeedFrame(const libav::AVFrame* frame, uint64_t canvasSerial = 0);
+    // A scope already rendered for the frame (ScopeBands), shown instead of drawing one;
+    // nullptr goes back to drawing. Uploaded right away, `scope` need not stay valid.
+    void FeedScope(const libav::AVTempFrame* scope);
+
+private slots:
+    void FlushUpdate();
 
 private:
     enum DrawMode {
@@ -32,7 +51,37 @@ private:
     virtual void resizeGL(int width, int height) override;
     virtual void keyPressEvent(QKeyEvent* keyEvent) override;
 
+    void RequestUpdate();
+    void BuildGeometry();
+    void BuildWaveform();
+    void BuildVectorscope();
+    void DrawScopePicture();
+
+    struct Vertex {
+        GLfloat x, y, z;
+        GLubyte r, g, b, a;
+    };
+
     DrawMode m_mode;
     const libav::AVFrame* m_frame;
+    uint64_t m_canvasSerial;
     bool m_vectorscope;
+
+    // Geometry of the current frame, retained until the frame or the mode changes
+    GLuint m_vbo;
+    bool m_geometryDirty;
+    GLenum m_primitive;
+    std::vector<Vertex> m_vertices;
+    std::vector<GLint> m_firsts;
+    std::vector<GLsizei> m_counts;
+
+    QGLCanvas* m_canvas;
+    std::unique_ptr<GLScope> m_gpuScope; // null where the GL lacks the features
+    GLPlaneStream m_scopePicture;
+    bool m_scopeUploaded;
+    int m_viewportWidth;
+    int m_viewportHeight;
+
+    bool m_updatePending;
+    QElapsedTimer m_lastPaint;
 };
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Decides which frames of a live feed are still worth showing. The lag of a frame is the
+// wall clock time since the stream started minus its presentation time, measured against
+// the quickest frame seen so far; frames lagging more than `maxLatency` are dropped.
+class LatencyPolicy
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit LatencyPolicy(unsigned maxLatency = 200) // milliseconds
+        : m_maxLatency(maxLatency)
+        , m_anchored(false)
+        , m_lastLag(0)
+    { }
+
+    bool Admit(uint64_t timestamp) // milliseconds since the first frame
+    {
+        const Clock::time_point now = Clock::now();
+        const Clock::time_point due = now - std::chrono::milliseconds(timestamp);
+        if (! m_anchored || due < m_anchor) {
+            m_anchor = due;
+            m_anchored = true;
+        }
+        m_lastLag = std::chrono::duration_cast<std::chrono::milliseconds>(due - m_anchor).count();
+        return m_lastLag <= m_maxLatency;
+    }
+
+    void Reset() { m_anchored = false; }
+
+    unsigned GetMaxLatency() const { return m_maxLatency; }
+    void SetMaxLatency(unsigned maxLatency) { m_maxLatency = maxLatency; }
+    int64_t GetLastLag() const { return m_lastLag; }
+
+private:
+    unsigned           m_maxLatency;
+    bool               m_anchored;
+    Clock::time_point  m_anchor;
+    int64_t            m_lastLag;
+};
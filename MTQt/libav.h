@@ -2,20 +2,30 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
 #include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 }
 
 #undef M_LOG2_10
 
+#include "alloctrack.h"
+#include "bufferpool.h"
+#include "workerpool.h"
+#include "yuvconvert.h"
+
 // TODO: Move to the other place
 class NoCopy
 {
@@ -152,23 +162,85 @@ private:
 };
 
 
+// Rows of a video picture the decoder has just finished, through draw_horiz_band. Bands
+// arrive top to bottom and in display order; the last one of a picture ends at `frameHeight`.
+struct AVBand
+{
+    const ::AVFrame*  picture;       // the decoder's, identifies the picture by data[0]
+    const uint8_t*    planes[3];     // the first row of the band in every plane
+    int               lineSizes[3];
+    unsigned          y;             // luma rows
+    unsigned          height;
+    unsigned          frameWidth;
+    unsigned          frameHeight;
+    ::PixelFormat     format;
+};
+
+
+// How much of the input libavformat reads before the first packet is handed out
+struct AVOpenOptions
+{
+    enum StreamInfo {
+        STREAM_INFO_ALWAYS,  // always run avformat_find_stream_info
+        STREAM_INFO_AUTO,    // only if the container headers leave codec parameters unknown
+        STREAM_INFO_NEVER
+    };
+
+    unsigned                probeSize;        // bytes, 0 keeps the libavformat default
+    int64_t                 analyzeDuration;  // microseconds, 0 keeps the libavformat default
+    StreamInfo              streamInfo;
+    int                     formatFlags;      // additional AVFMT_FLAG_*
+    bool                    lowDelay;         // decode without frame threading or reordering delay
+    bool                    keyframesOnly;    // the decoders discard everything but keyframes
+    bool                    preview;          // the video decoder starts in the preview profile (AVStream::SetPreview)
+    bool                    videoOnly;        // the demuxer discards all other streams, AVStream decodes no audio
+    std::function<bool()>   interrupt;        // returning true aborts blocking I/O
+    // Called on the decoding thread for every band of video, where the codec can hand out
+    // bands; the video decoder then runs on one thread
+    std::function<void(const AVBand&)>  videoBands;
+
+    AVOpenOptions()
+        : probeSize(0)
+        , analyzeDuration(0)
+        , streamInfo(STREAM_INFO_ALWAYS)
+        , formatFlags(0)
+        , lowDelay(false)
+        , keyframesOnly(false)
+        , preview(false)
+        , videoOnly(false)
+    { }
+};
+
+
 class AVInputFile : public AVInit
 {
     friend class AVPacket;
 
 public:
-    AVInputFile(const char* uri)
-        : m_formatCtx(Construct(uri))
+    AVInputFile(const char* uri, const AVOpenOptions& options = AVOpenOptions())
+        : m_interrupt(options.interrupt)
+        , m_formatCtx(Construct(uri, options, this))
         , m_source(nullptr)
+        , m_lowDelay(options.lowDelay)
+        , m_keyframesOnly(options.keyframesOnly)
+        , m_preview(options.preview)
+        , m_videoOnly(options.videoOnly)
+        , m_videoBands(options.videoBands)
     {
-        ::avformat_find_stream_info(m_formatCtx, nullptr); // ignore errors
+        FindStreamInfo(options);
     }
 
-    AVInputFile(IAVDataSource& source, const char* name)
-        : m_formatCtx(Construct(source, name))
+    AVInputFile(IAVDataSource& source, const char* name, const AVOpenOptions& options = AVOpenOptions())
+        : m_interrupt(options.interrupt)
+        , m_formatCtx(Construct(source, name, options, this))
         , m_source(&source)
+        , m_lowDelay(options.lowDelay)
+        , m_keyframesOnly(options.keyframesOnly)
+        , m_preview(options.preview)
+        , m_videoOnly(options.videoOnly)
+        , m_videoBands(options.videoBands)
     {
-        ::avformat_find_stream_info(m_formatCtx, nullptr); // ignore errors
+        FindStreamInfo(options);
     }
 
     virtual ~AVInputFile()
@@ -181,12 +253,49 @@ public:
     uint64_t GetFileSize() const { return 0; /* TODO: m_formatCtx->filesize; */ } // bytes
     unsigned GetBitRate() const { return m_formatCtx->bit_rate; }
     const char* GetContainerName() const { return m_formatCtx->iformat->name; }
+    unsigned GetStreamCount() const { return m_formatCtx->nb_streams; }
+    bool GetStreamInfoProbed() const { return m_streamInfoProbed; }
+    bool GetLowDelay() const { return m_lowDelay; }
+    bool GetKeyframesOnly() const { return m_keyframesOnly; }
+    bool GetPreview() const { return m_preview; }
+    bool GetVideoOnly() const { return m_videoOnly; }
+    const std::function<void(const AVBand&)>& GetVideoBands() const { return m_videoBands; }
 
     bool Stopped() const
     {
         return m_source ? !m_source->GetOkToRead() : false;
     }
 
+    bool Seek(unsigned streamIndex, int64_t sourceTimestamp) const
+    {
+        return ::av_seek_frame(m_formatCtx, streamIndex, sourceTimestamp, AVSEEK_FLAG_BACKWARD) >= 0;
+    }
+
+    bool HasStream(int type) const
+    {
+        for (unsigned i = 0; i < m_formatCtx->nb_streams; ++i) {
+            if (m_formatCtx->streams[i]->codec->codec_type == type)
+                return true;
+        }
+        return false;
+    }
+
+    // Frames per second of the first video stream, 0 when the container does not tell
+    double GetFrameRate() const
+    {
+        for (unsigned i = 0; i < m_formatCtx->nb_streams; ++i) {
+            const ::AVStream* stream = m_formatCtx->streams[i];
+            if (stream->codec->codec_type != AVMEDIA_TYPE_VIDEO)
+                continue;
+            if (stream->avg_frame_rate.num && stream->avg_frame_rate.den)
+                return ::av_q2d(stream->avg_frame_rate);
+            if (stream->r_frame_rate.num && stream->r_frame_rate.den)
+                return ::av_q2d(stream->r_frame_rate);
+            return 0.0;
+        }
+        return 0.0;
+    }
+
     AVCodec FindStream(int type) const
     {
         for (unsigned i = 0; i < m_formatCtx->nb_streams; ++i) {
@@ -197,18 +306,33 @@ public:
     }
 
 private:
-    static inline ::AVFormatContext* Construct(const char* uri)
+    static inline ::AVFormatContext* Alloc(const AVOpenOptions& options, AVInputFile* self)
+    {
+        ::AVFormatContext* ret = ::avformat_alloc_context();
+        if (! ret)
+            throw AVError("avformat_alloc_context");
+        if (options.probeSize)
+            ret->probesize = options.probeSize;
+        if (options.analyzeDuration)
+            ret->max_analyze_duration = options.analyzeDuration;
+        ret->flags |= options.formatFlags;
+        ret->interrupt_callback.callback = DoInterrupt;
+        ret->interrupt_callback.opaque = self;
+        return ret;
+    }
+
+    static inline ::AVFormatContext* Construct(const char* uri, const AVOpenOptions& options, AVInputFile* self)
     {
-        ::AVFormatContext* ret = nullptr;
+        ::AVFormatContext* ret = Alloc(options, self);
         int err = ::avformat_open_input(&ret, uri, nullptr, nullptr);
         if (err)
             throw AVError("av_open_input_file", err);
         return ret;
     }
 
-    static inline ::AVFormatContext* Construct(IAVDataSource& source, const char* name)
+    static inline ::AVFormatContext* Construct(IAVDataSource& source, const char* name, const AVOpenOptions& options, AVInputFile* self)
     {
-        ::AVFormatContext* ret = ::avformat_alloc_context();
+        ::AVFormatContext* ret = Alloc(options, self);
         ret->flags |= AVFMT_FLAG_CUSTOM_IO;
         ret->pb = source.AllocContext();
         int err = ::avformat_open_input(&ret, name, nullptr, nullptr);
@@ -217,9 +341,51 @@ private:
         return ret;
     }
 
+    static int DoInterrupt(void* opaque)
+    {
+        const AVInputFile& self = *static_cast<const AVInputFile*>(opaque);
+        return self.m_interrupt && self.m_interrupt() ? 1 : 0;
+    }
+
+    // True if every stream already has the parameters its decoder needs
+    bool HeadersSufficient() const
+    {
+        for (unsigned i = 0; i < m_formatCtx->nb_streams; ++i) {
+            const ::AVCodecContext* ctx = m_formatCtx->streams[i]->codec;
+            if (ctx->codec_id == AV_CODEC_ID_NONE)
+                return false;
+            if (ctx->codec_type == AVMEDIA_TYPE_VIDEO && (! ctx->width || ! ctx->height || ctx->pix_fmt == PIX_FMT_NONE))
+                return false;
+            if (ctx->codec_type == AVMEDIA_TYPE_AUDIO && (! ctx->sample_rate || ! ctx->channels || ctx->sample_fmt == AV_SAMPLE_FMT_NONE))
+                return false;
+        }
+        return m_formatCtx->nb_streams > 0;
+    }
+
+    void FindStreamInfo(const AVOpenOptions& options)
+    {
+        m_streamInfoProbed = options.streamInfo == AVOpenOptions::STREAM_INFO_ALWAYS
+            || (options.streamInfo == AVOpenOptions::STREAM_INFO_AUTO && ! HeadersSufficient());
+        if (m_streamInfoProbed)
+            ::avformat_find_stream_info(m_formatCtx, nullptr); // ignore errors
+        if (options.videoOnly) {
+            for (unsigned i = 0; i < m_formatCtx->nb_streams; ++i) {
+                if (m_formatCtx->streams[i]->codec->codec_type != AVMEDIA_TYPE_VIDEO)
+                    m_formatCtx->streams[i]->discard = AVDISCARD_ALL;
+            }
+        }
+    }
+
 private:
-    ::AVFormatContext* const    m_formatCtx;
-    const IAVDataSource* const  m_source;
+    const std::function<bool()>  m_interrupt;
+    ::AVFormatContext* const     m_formatCtx;
+    const IAVDataSource* const   m_source;
+    const bool                   m_lowDelay;
+    const bool                   m_keyframesOnly;
+    const bool                   m_preview;
+    const bool                   m_videoOnly;
+    const std::function<void(const AVBand&)>  m_videoBands;
+    bool                         m_streamInfoProbed;
 };
 
 
@@ -243,6 +409,7 @@ public:
 
     bool Read(const AVInputFile& in, bool& stopped)
     {
+        AllocTracker::Scope stage(AllocTracker::STAGE_DEMUX);
         stopped = false;
         m_complete = false;
         if (in.Stopped()) {
@@ -278,6 +445,11 @@ public:
         return (unsigned)m_packet.stream_index;
     }
 
+    bool IsKey() const
+    {
+        return m_packet.flags & AV_PKT_FLAG_KEY;
+    }
+
     bool Empty() const
     {
         return (! m_complete) || (m_packet.size == 0);
@@ -291,6 +463,20 @@ public:
         m_rawPacket.size = 0;
     }
 
+    void Reset()
+    {
+        Free();
+        m_packet = m_rawPacket;
+        m_complete = false;
+    }
+
+    void Swap(AVPacket& other)
+    {
+        std::swap(m_packet, other.m_packet);
+        std::swap(m_rawPacket, other.m_rawPacket);
+        std::swap(m_complete, other.m_complete);
+    }
+
 private:
     ::AVPacket  m_packet;
     ::AVPacket  m_rawPacket;
@@ -298,6 +484,19 @@ private:
 };
 
 
+// Alternative supplier of packets for AVStream, e.g. a demuxer running on its own thread.
+// Packets must come out in the order the container stores them.
+class IAVPacketSource
+{
+public:
+    virtual bool Read(AVPacket& packet, bool& stopped) = 0; // replaces the content of `packet`
+    virtual bool Seek(unsigned streamIndex, int64_t sourceTimestamp) = 0;
+
+protected:
+    virtual ~IAVPacketSource() { }
+};
+
+
 class AVFrameBase : NoCopy
 {
 public:
@@ -329,11 +528,29 @@ class AVFrame : public AVFrameBase
 {
 public:
     AVFrame()
+        : m_preview(false)
+        , m_lowres(0)
     {
         memset(&m_frame, 0, sizeof(m_frame));
         ::av_frame_unref(&m_frame);
     }
 
+    ~AVFrame()
+    {
+        ::av_frame_unref(&m_frame);
+    }
+
+    // Shares the picture of `src` instead of copying it, if the decoder hands out reference counted frames
+    void Ref(const AVFrame& src)
+    {
+        ::av_frame_unref(&m_frame);
+        if (::av_frame_ref(&m_frame, src.GetRaw()) < 0)
+            throw AVError("av_frame_ref");
+        SetTimeBase(src.GetTimeBase());
+        SetTimeOffset(src.GetTimeOffset());
+        SetPreview(src.IsPreview(), src.GetLowres());
+    }
+
     const ::AVFrame* GetRaw() const { return &m_frame; }
     ::AVFrame* GetRaw() { return &m_frame; }
     const ::AVPicture* GetPicture() const { return reinterpret_cast<const ::AVPicture*>(&m_frame); }
@@ -349,8 +566,16 @@ public:
     const uint8_t* GetPlane(unsigned idx) const { assert(idx < 4); return m_frame.data[idx]; }
     unsigned GetLineSize(unsigned idx) const { assert(idx < 4); return m_frame.linesize[idx]; }
 
+    // Decoded with the shortcuts of the preview profile: approximate pixels, and with a
+    // lowres of n the picture is 2^n times smaller than the coded size in both directions
+    bool IsPreview() const { return m_preview; }
+    unsigned GetLowres() const { return m_lowres; }
+    void SetPreview(bool preview, unsigned lowres) { m_preview = preview; m_lowres = lowres; }
+
 private:
     ::AVFrame m_frame;
+    bool      m_preview;
+    unsigned  m_lowres;
 };
 
 
@@ -373,7 +598,7 @@ class AVSamples : public AVFrameBase
 public:
     AVSamples()
         : m_capacity(192000) // 1 second of 48khz 32 bit audio
-        , m_samples(static_cast<int16_t*>(::av_malloc(m_capacity)))
+        , m_samples(static_cast<int16_t*>(AVBufferPool::Instance().Acquire(m_capacity)))
         , m_size(0)
         , m_timestamp(0)
         , m_codecCtx(nullptr)
@@ -381,7 +606,7 @@ public:
 
     ~AVSamples()
     {
-        ::av_free(m_samples);
+        AVBufferPool::Instance().Release(m_samples, m_capacity);
     }
 
     int16_t* GetRaw() { return m_samples; }
@@ -484,6 +709,10 @@ public:
 
     int Decode(::AVCodecContext* ctx, AVFrame& frame, AVPacket& packet, int& finished)
     {
+        // The previous picture belongs to us with reference counting, whoever needs it has taken a reference
+        if (ctx->refcounted_frames)
+            ::av_frame_unref(frame.GetRaw());
+        frame.SetPreview(ctx->lowres || ctx->skip_loop_filter != AVDISCARD_DEFAULT || ctx->skip_idct != AVDISCARD_DEFAULT, ctx->lowres);
         return ::avcodec_decode_video2(ctx, frame.GetRaw(), &finished, packet.GetPacket());
     }
 };
@@ -517,12 +746,17 @@ public:
         : AVCodecBase(c.context)
         , m_engine(engine)
         , m_timeBase(::av_q2d(c.timeBase))
+        , m_lowDelay(c.input.GetLowDelay())
+        , m_keyframesOnly(c.input.GetKeyframesOnly())
+        , m_preview(c.input.GetPreview() && engine.GetStreamType() == AVMEDIA_TYPE_VIDEO)
+        , m_bands(engine.GetStreamType() == AVMEDIA_TYPE_VIDEO ? c.input.GetVideoBands() : nullptr)
     {
         Init();
     }
 
     bool DecodeFrame(typename TEngine::TFrameType& frame, AVPacket& packet, bool& failed)
     {
+        AllocTracker::Scope stage(AllocTracker::STAGE_DECODE);
         frame.SetTimeBase(m_timeBase);
 
         int finished = 0;
@@ -538,9 +772,92 @@ public:
         return finished;
     }
 
+    void Flush()
+    {
+        ::avcodec_flush_buffers(m_codecCtx.get());
+    }
+
+    double GetTimeBase() const { return m_timeBase; }
+
+    bool GetPreview() const { return m_preview; }
+    bool HasBands() const { return m_codecCtx->draw_horiz_band != nullptr; }
+
+    // The skip settings apply from the next packet on. A different lowres needs the codec
+    // reopened, which drops its reference pictures: seek afterwards.
+    void SetPreview(bool preview)
+    {
+        if (preview == m_preview || m_engine.GetStreamType() != AVMEDIA_TYPE_VIDEO)
+            return;
+        m_preview = preview;
+        const int lowres = m_codecCtx->lowres;
+        ApplyPreview();
+        if (m_codecCtx->lowres != lowres) {
+            ::avcodec_close(m_codecCtx.get());
+            Init();
+        }
+    }
+
+protected:
+    // Decoder shortcuts for skimming: half size where the codec can decode it directly, no
+    // loop filter, no IDCT on pictures nothing else refers to, and the fast bitstream tricks
+    void ApplyPreview()
+    {
+        m_codecCtx->lowres = m_preview ? std::min(1, int(m_codec->max_lowres)) : 0;
+        m_codecCtx->skip_loop_filter = m_preview ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+        m_codecCtx->skip_idct = m_preview ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+        if (m_preview)
+            m_codecCtx->flags2 |= CODEC_FLAG2_FAST;
+        else
+            m_codecCtx->flags2 &= ~CODEC_FLAG2_FAST;
+    }
+
+    virtual void PrepareContext()
+    {
+        AVCodecBase::PrepareContext();
+        if (m_lowDelay) {
+            m_codecCtx->flags |= CODEC_FLAG_LOW_DELAY;
+            m_codecCtx->thread_count = 1; // frame threads hold back one frame per thread
+        }
+        if (m_keyframesOnly)
+            m_codecCtx->skip_frame = AVDISCARD_NONKEY;
+        if (m_engine.GetStreamType() == AVMEDIA_TYPE_VIDEO) {
+            m_codecCtx->refcounted_frames = 1; // lets decoded pictures be cached without copies
+            ApplyPreview();
+        }
+        // Slice threads would hand out bands concurrently and frame threads not at all
+        if (m_bands && (m_codec->capabilities & CODEC_CAP_DRAW_HORIZ_BAND)) {
+            m_codecCtx->opaque = this;
+            m_codecCtx->draw_horiz_band = DrawBand;
+            m_codecCtx->slice_flags = 0; // whole pictures in display order, not fields in coded order
+            m_codecCtx->thread_count = 1;
+        }
+    }
+
+private:
+    static void DrawBand(::AVCodecContext* ctx, const ::AVFrame* src, int offset[AV_NUM_DATA_POINTERS], int y, int /*type*/, int height)
+    {
+        const AVEngineDecoder& self = *static_cast<const AVEngineDecoder*>(ctx->opaque);
+        AVBand band;
+        band.picture = src;
+        for (unsigned i = 0; i < 3; ++i) {
+            band.planes[i] = src->data[i] ? src->data[i] + offset[i] : nullptr;
+            band.lineSizes[i] = src->linesize[i];
+        }
+        band.y = y;
+        band.height = height;
+        band.frameWidth = ctx->width;
+        band.frameHeight = ctx->height;
+        band.format = ctx->pix_fmt;
+        self.m_bands(band);
+    }
+
 private:
     TEngine&      m_engine;
     const double  m_timeBase;
+    const bool    m_lowDelay;
+    const bool    m_keyframesOnly;
+    bool          m_preview;
+    const std::function<void(const AVBand&)>  m_bands;
 };
 
 
@@ -569,25 +886,40 @@ class AVStream : NoCopy
         template< typename TCallback >
         bool Decode(AVPacket& packet, TCallback& callback)
         {
-            if (packet.Index() == codec.index) {
-                while (cont && decoder.DecodeFrame(frame, packet, failed)) {
-                    frame.SetTimeOffset(timeOffset);
-                    if (! index) {
-                        timeOffset = frame.GetTimestamp();
-                        frame.SetTimeOffset(timeOffset);
-                    }
-                    cont &= callback(frame, ++index);
-                }
-            }
+            while (cont && DecodeNext(packet))
+                cont &= callback(frame, index);
             return cont;
         }
+
+        // One frame at a time; what is left of `packet` goes to the next call
+        bool DecodeNext(AVPacket& packet)
+        {
+            if (packet.Index() != codec.index || ! decoder.DecodeFrame(frame, packet, failed))
+                return false;
+            frame.SetTimeOffset(timeOffset);
+            if (! index) {
+                timeOffset = frame.GetTimestamp();
+                frame.SetTimeOffset(timeOffset);
+            }
+            ++index;
+            return true;
+        }
+
+        void Flush()
+        {
+            decoder.Flush();
+            failed = false;
+            cont = true;
+        }
     };
 
 public:
     AVStream(const AVInputFile& inp)
         : m_input(inp)
+        , m_source(nullptr)
         , m_videoWorker(inp)
-        , m_audioWorker(inp)
+        , m_audioWorker(! inp.GetVideoOnly() && inp.HasStream(AVMEDIA_TYPE_AUDIO) ? new Worker< AVAudioEngine >(inp) : nullptr)
+        , m_ended(false)
     {
     }
 
@@ -596,15 +928,29 @@ public:
         return m_videoWorker.decoder.GetCodecName();
     }
 
+    std::vector<unsigned> GetStreamIndexes() const
+    {
+        if (! m_audioWorker)
+            return { m_videoWorker.codec.index };
+        return { m_videoWorker.codec.index, m_audioWorker->codec.index };
+    }
+
+    // Read packets from `source` instead of the input file, nullptr restores direct reading
+    void SetPacketSource(IAVPacketSource* source)
+    {
+        m_packet.Reset();
+        m_source = source;
+    }
+
     template< typename TCallback >
     bool Decode(TCallback& callback, bool decodeSinglePacket = false) // by default decode all packets (whole file)
     {
         while (m_packet.Empty()) {
-            if (! m_packet.Read(m_input, callback.stopped))
+            if (! ReadPacket(callback.stopped))
                 return false;
 
             bool video = m_videoWorker.Decode(m_packet, callback);
-            bool audio = m_audioWorker.Decode(m_packet, callback);
+            bool audio = m_audioWorker && m_audioWorker->Decode(m_packet, callback);
             if (! video && ! audio)
                 return true;
             m_packet.Consume(m_packet.Size());
@@ -615,13 +961,97 @@ public:
         return true;
     }
 
+    // Pull counterpart of Decode for video, use one or the other on a stream. Decodes only
+    // as many packets as the next frame takes; the audio on the way is decoded into `onAudio`,
+    // or skipped without one. The frame is the decoder's and valid until the next call; nullptr
+    // at the end of the stream, or when `mayRead` returns false before a packet would have to
+    // be read.
+    template< typename TMayRead, typename TOnAudio >
+    const AVFrame* NextVideoFrame(TMayRead mayRead, TOnAudio onAudio)
+    {
+        while (true) {
+            if (m_packet.Empty()) {
+                bool stopped = false;
+                if (! mayRead())
+                    return nullptr;
+                if (! ReadPacket(stopped)) {
+                    m_ended = true;
+                    return nullptr;
+                }
+            }
+            if (m_videoWorker.DecodeNext(m_packet))
+                return &m_videoWorker.frame;
+            DecodeAudio(onAudio);
+            m_packet.Consume(m_packet.Size());
+        }
+    }
+
+    template< typename TMayRead >
+    const AVFrame* NextVideoFrame(TMayRead mayRead)
+    {
+        return NextVideoFrame(mayRead, nullptr);
+    }
+
+    const AVFrame* NextVideoFrame()
+    {
+        return NextVideoFrame([]() { return true; }, nullptr);
+    }
+
+    bool IsEnded() const { return m_ended; } // NextVideoFrame ran out of packets
+
+    // Switches the video decoder between full quality and the preview profile; the frames
+    // tell which one they came from. Seek afterwards, the decoder may have lost its references.
+    void SetPreview(bool preview) { m_videoWorker.decoder.SetPreview(preview); }
+    bool GetPreview() const { return m_videoWorker.decoder.GetPreview(); }
+    // Whether the AVOpenOptions::videoBands callback sees the pictures of this stream
+    bool HasVideoBands() const { return m_videoWorker.decoder.HasBands(); }
+
+    // Positions the stream at the last keyframe before `timestamp` (milliseconds since the first frame)
+    bool Seek(uint64_t timestamp)
+    {
+        const double seconds = (timestamp + m_videoWorker.timeOffset) / 1000.0;
+        return SeekSource(static_cast<int64_t>(seconds / m_videoWorker.decoder.GetTimeBase()));
+    }
+
+    bool SeekSource(int64_t sourceTimestamp)
+    {
+        const unsigned index = m_videoWorker.codec.index;
+        if (! (m_source ? m_source->Seek(index, sourceTimestamp) : m_input.Seek(index, sourceTimestamp)))
+            return false;
+        m_packet.Reset();
+        m_videoWorker.Flush();
+        if (m_audioWorker)
+            m_audioWorker->Flush();
+        m_ended = false;
+        return true;
+    }
+
+private:
+    bool ReadPacket(bool& stopped)
+    {
+        return m_source ? m_source->Read(m_packet, stopped) : m_packet.Read(m_input, stopped);
+    }
+
+    template< typename TOnAudio >
+    void DecodeAudio(TOnAudio& onAudio)
+    {
+        if (m_audioWorker) {
+            while (m_audioWorker->DecodeNext(m_packet))
+                onAudio(m_audioWorker->frame);
+        }
+    }
+
+    void DecodeAudio(std::nullptr_t) { }
+
 private:
     const AVInputFile& m_input;
+    IAVPacketSource* m_source;
 
     AVPacket m_packet;
 
     Worker< AVVideoEngine > m_videoWorker;
-    Worker< AVAudioEngine > m_audioWorker;
+    std::unique_ptr< Worker< AVAudioEngine > > m_audioWorker; // nullptr for video only input
+    bool m_ended;
 };
 
 
@@ -639,11 +1069,114 @@ struct AVImageFormat
 };
 
 
+// Converts horizontal bands of a picture concurrently, each band with its own scaler. Only
+// conversions where every output row depends on the same input row alone are split, so the
+// result is bit-identical to one pass: the built-in YUV conversion, and swscale without
+// vertical scaling or a change of vertical chroma subsampling.
+class AVBandedConvert : public NoCopy
+{
+public:
+    static const unsigned BAND_ALIGNMENT = 16; // rows, a multiple of any chroma subsampling and of swscale's dither patterns
+
+    explicit AVBandedConvert(unsigned threads)
+        : m_pool(threads)
+    { }
+
+    ~AVBandedConvert()
+    {
+        for (struct ::SwsContext* ctx : m_swsCtxs)
+            if (ctx)
+                ::sws_freeContext(ctx);
+    }
+
+    unsigned GetThreadCount() const { return m_pool.GetThreadCount(); }
+
+    static bool IsRowLocal(const ::AVFrame& s, const ::AVFrame& d)
+    {
+        if (s.height != d.height)
+            return false;
+        const ::AVPixFmtDescriptor* sd = ::av_pix_fmt_desc_get(static_cast<enum ::PixelFormat>(s.format));
+        const ::AVPixFmtDescriptor* dd = ::av_pix_fmt_desc_get(static_cast<enum ::PixelFormat>(d.format));
+        const int special = PIX_FMT_PAL | PIX_FMT_PSEUDOPAL | PIX_FMT_HWACCEL; // data[1] is no picture plane
+        return sd && dd && ! (sd->flags & special) && ! (dd->flags & special) && sd->log2_chroma_h == dd->log2_chroma_h;
+    }
+
+    // Returns false, without touching `d`, if the conversion is not split
+    bool Convert(const ::AVFrame& s, ::AVFrame& d)
+    {
+        const unsigned bands = std::min(m_pool.GetThreadCount(), unsigned(d.height) / BAND_ALIGNMENT);
+        if (bands < 2)
+            return false;
+
+        if (YuvConvert::Supports(s, d)) {
+            m_pool.Run(bands, [&](unsigned band) {
+                AllocTracker::Scope stage(AllocTracker::STAGE_CONVERT);
+                YuvConvert::ConvertRows(s, d, BandStart(band, bands, d.height), BandStart(band + 1, bands, d.height));
+            });
+            return true;
+        }
+        if (! IsRowLocal(s, d))
+            return false;
+
+        m_swsCtxs.resize(std::max(m_swsCtxs.size(), size_t(bands)), nullptr);
+        std::vector<int> errors(bands, 0);
+        m_pool.Run(bands, [&](unsigned band) {
+            AllocTracker::Scope stage(AllocTracker::STAGE_CONVERT);
+            const unsigned first = BandStart(band, bands, d.height);
+            const int height = BandStart(band + 1, bands, d.height) - first;
+            struct ::SwsContext*& ctx = m_swsCtxs[band];
+            ctx = ::sws_getCachedContext(ctx,
+                                         s.width, height, static_cast<enum ::PixelFormat>(s.format),
+                                         d.width, height, static_cast<enum ::PixelFormat>(d.format),
+                                         SWS_SINC,
+                                         nullptr, nullptr, nullptr);
+            if (! ctx) {
+                errors[band] = -1;
+                return;
+            }
+            uint8_t* src[4];
+            uint8_t* dst[4];
+            BandPlanes(s, first, src);
+            BandPlanes(d, first, dst);
+            const int err = ::sws_scale(ctx, src, s.linesize, 0, height, dst, d.linesize);
+            errors[band] = std::min(err, 0);
+        });
+        for (int err : errors)
+            if (err < 0)
+                throw AVError("sws_scale", err);
+        return true;
+    }
+
+private:
+    static unsigned BandStart(unsigned band, unsigned bands, unsigned height)
+    {
+        if (band == bands)
+            return height;
+        return unsigned(uint64_t(height) * band / bands) / BAND_ALIGNMENT * BAND_ALIGNMENT;
+    }
+
+    static void BandPlanes(const ::AVFrame& frame, unsigned first, uint8_t** planes)
+    {
+        const ::AVPixFmtDescriptor* desc = ::av_pix_fmt_desc_get(static_cast<enum ::PixelFormat>(frame.format));
+        for (unsigned i = 0; i < 4; ++i) {
+            const unsigned row = i == 1 || i == 2 ? first >> desc->log2_chroma_h : first;
+            planes[i] = frame.data[i] ? frame.data[i] + size_t(row) * frame.linesize[i] : nullptr;
+        }
+    }
+
+private:
+    WorkerPool                          m_pool;
+    std::vector<struct ::SwsContext*>   m_swsCtxs; // one per band
+};
+
+
 class AVImageConvert : public NoCopy
 {
 public:
-    AVImageConvert(const AVImageFormat& src, const AVImageFormat& dst)
+    // With more than one thread, large pictures are converted in bands where that gives the same result
+    AVImageConvert(const AVImageFormat& src, const AVImageFormat& dst, unsigned threads = 1)
         : m_swsCtx(Construct(src, dst))
+        , m_bands(threads > 1 ? new AVBandedConvert(threads) : nullptr)
     {
     }
 
@@ -655,8 +1188,13 @@ public:
 
     void Convert(AVFrame& dst, const AVFrame& src)
     {
+        AllocTracker::Scope stage(AllocTracker::STAGE_CONVERT);
         const ::AVFrame& s = *src.GetRaw();
         ::AVFrame& d = *dst.GetRaw();
+        if (m_bands && m_bands->Convert(s, d))
+            return;
+        if (YuvConvert::Convert(s, d))
+            return;
         int err = ::sws_scale(m_swsCtx, s.data, s.linesize, 0, s.height, d.data, d.linesize);
         if (err < 0)
             throw AVError("sws_scale", err);
@@ -678,6 +1216,63 @@ private:
 
 private:
     struct ::SwsContext* const m_swsCtx;
+    std::unique_ptr<AVBandedConvert> m_bands;
+};
+
+
+// Keeps the scaler of the last conversion, for repeated conversions between the same formats
+class AVImageConvertCache : public NoCopy
+{
+public:
+    AVImageConvertCache()
+        : m_swsCtx(nullptr)
+    { }
+
+    ~AVImageConvertCache()
+    {
+        if (m_swsCtx)
+            ::sws_freeContext(m_swsCtx);
+    }
+
+    void Convert(AVFrame& dst, const AVFrame& src)
+    {
+        AllocTracker::Scope stage(AllocTracker::STAGE_CONVERT);
+        const ::AVFrame& s = *src.GetRaw();
+        ::AVFrame& d = *dst.GetRaw();
+        if (m_bands && m_bands->Convert(s, d))
+            return;
+        if (YuvConvert::Convert(s, d))
+            return; // the common YUV to RGB cases, without swscale
+        m_swsCtx = ::sws_getCachedContext(m_swsCtx,
+                                          s.width, s.height, static_cast<enum ::PixelFormat>(s.format),
+                                          d.width, d.height, static_cast<enum ::PixelFormat>(d.format),
+                                          SWS_SINC,
+                                          nullptr, nullptr, nullptr);
+        if (! m_swsCtx)
+            throw AVError("sws_getCachedContext");
+        int err = ::sws_scale(m_swsCtx, s.data, s.linesize, 0, s.height, d.data, d.linesize);
+        if (err < 0)
+            throw AVError("sws_scale", err);
+    }
+
+    // One cache per thread, temporary frames are converted on whichever thread needs them
+    static AVImageConvertCache& ForThread()
+    {
+        static thread_local AVImageConvertCache cache;
+        return cache;
+    }
+
+    // More than one thread converts large pictures in bands, see AVBandedConvert
+    void SetThreads(unsigned threads)
+    {
+        m_bands.reset(threads > 1 ? new AVBandedConvert(threads) : nullptr);
+    }
+
+    unsigned GetThreads() const { return m_bands ? m_bands->GetThreadCount() : 1; }
+
+private:
+    struct ::SwsContext* m_swsCtx;
+    std::unique_ptr<AVBandedConvert> m_bands;
 };
 
 
@@ -751,32 +1346,61 @@ public:
         ConvertFrame(fmt, src);
     }
 
+    // Deep copy that outlives the decoder's reuse of `src`
+    explicit AVTempFrame(const AVFrame& src)
+    {
+        const ::AVFrame& rf = *src.GetRaw();
+        const ::PixelFormat format = static_cast<enum ::PixelFormat>(rf.format);
+        AllocFrame(AVImageFormat(rf.width, rf.height, format));
+        ::av_picture_copy(GetPicture(), src.GetPicture(), format, rf.width, rf.height);
+        GetRaw()->key_frame = rf.key_frame;
+        GetRaw()->colorspace = rf.colorspace;
+        GetRaw()->color_range = rf.color_range;
+        SetTimeBase(src.GetTimeBase());
+        SetTimeOffset(src.GetTimeOffset());
+        SetSourceTimestamp(src.GetSourceTimestamp());
+        SetPreview(src.IsPreview(), src.GetLowres());
+    }
+
     virtual ~AVTempFrame()
     {
-        ::avpicture_free(GetPicture());
+        AVBufferPool::Instance().Release(m_buffer, m_bufferSize);
+    }
+
+    // Converts `src` into the existing picture, keeping this frame's size and format
+    void ConvertFrom(const AVFrame& src)
+    {
+        AVImageConvertCache::ForThread().Convert(*this, src);
+        SetTimeBase(src.GetTimeBase());
+        SetTimeOffset(src.GetTimeOffset());
+        SetSourceTimestamp(src.GetSourceTimestamp());
+        SetPreview(src.IsPreview(), src.GetLowres());
     }
 
 private:
     void AllocFrame(const AVImageFormat& fmt)
     {
-        int s = ::avpicture_alloc(GetPicture(), fmt.format, fmt.width, fmt.height);
+        // Same layout as avpicture_alloc, but the memory comes from the pool
+        int s = ::avpicture_get_size(fmt.format, fmt.width, fmt.height);
         if (s < 0)
-            throw AVError("av_picture_alloc", s);
+            throw AVError("avpicture_get_size", s);
+        m_bufferSize = s;
+        m_buffer = static_cast<uint8_t*>(AVBufferPool::Instance().Acquire(m_bufferSize));
+        ::avpicture_fill(GetPicture(), m_buffer, fmt.format, fmt.width, fmt.height);
         GetRaw()->width = fmt.width;
         GetRaw()->height = fmt.height;
+        GetRaw()->format = fmt.format;
     }
 
     void ConvertFrame(const AVImageFormat& fmt, const AVFrame& src)
     {
         AllocFrame(fmt);
-        const ::AVFrame& rf = *src.GetRaw();
-        AVImageFormat srcf(rf.width, rf.height, static_cast<enum ::PixelFormat>(rf.format));
-        AVImageConvert conv(srcf, fmt);
-        conv.Convert(*this, src);
-        SetTimeBase(src.GetTimeBase());
-        SetTimeOffset(src.GetTimeOffset());
-        SetSourceTimestamp(src.GetSourceTimestamp());
+        ConvertFrom(src);
     }
+
+private:
+    uint8_t*  m_buffer = nullptr;
+    size_t    m_bufferSize = 0;
 };
 
 
@@ -814,9 +1438,16 @@ private:
 class AVThumbnailEncoder : AVInit, public AVCodecBase
 {
 public:
-    AVThumbnailEncoder(const char* codec, unsigned width, unsigned height)
+    // A `frameRate` makes it a video encoder: frames get consecutive pts and Flush() drains delayed
+    // frames. A keyframe starts every `gopSize` frames, with up to `bFrames` B-frames in a row.
+    AVThumbnailEncoder(const char* codec, unsigned width, unsigned height, double frameRate = 0.0,
+                       unsigned gopSize = 12, unsigned bFrames = 0)
         : AVCodecBase(Construct(codec))
         , m_dstf(width, height, m_codec->pix_fmts[0])
+        , m_frameRate(frameRate)
+        , m_gopSize(gopSize)
+        , m_bFrames(bFrames)
+        , m_pts(0)
     {
         Init();
     }
@@ -824,12 +1455,22 @@ public:
     size_t Encode(void *buf, size_t size, const AVFrame& frame)
     {
         AVTempFrame df(m_dstf, frame);
+        df.GetRaw()->pts = m_pts++;
         int s = ::avcodec_encode_video(m_codecCtx.get(), (uint8_t*)buf, size, df.GetRaw());
         if (s < 0)
             throw AVError("avcodec_encode_video", s);
         return s;
     }
 
+    // Returns 0 once the encoder holds no more frames
+    size_t Flush(void *buf, size_t size)
+    {
+        int s = ::avcodec_encode_video(m_codecCtx.get(), (uint8_t*)buf, size, nullptr);
+        if (s < 0)
+            throw AVError("avcodec_encode_video", s);
+        return s;
+    }
+
     uint32_t GetWidth()  const { return m_dstf.width; }
     uint32_t GetHeight() const { return m_dstf.height; }
 
@@ -839,6 +1480,15 @@ protected:
         m_codecCtx->pix_fmt = m_dstf.format;
         m_codecCtx->width = m_dstf.width;
         m_codecCtx->height = m_dstf.height;
+        if (m_frameRate > 0.0) {
+            const bool integral = m_frameRate == std::floor(m_frameRate);
+            m_codecCtx->time_base.num = integral ? 1 : 1001;
+            m_codecCtx->time_base.den = integral ? int(m_frameRate) : int(std::lround(m_frameRate * 1001));
+            m_codecCtx->gop_size = m_gopSize;
+            m_codecCtx->max_b_frames = m_bFrames;
+            // About 0.1 bit per pixel, so that decoding costs what it does for real content
+            m_codecCtx->bit_rate = int(std::lround(m_dstf.width * m_dstf.height * m_frameRate * 0.1));
+        }
     }
 
 private:
@@ -851,7 +1501,11 @@ private:
     }
 
 private:
-    AVImageFormat m_dstf;
+    AVImageFormat   m_dstf;
+    const double    m_frameRate;
+    const unsigned  m_gopSize;
+    const unsigned  m_bFrames;
+    int64_t         m_pts;
 };
 
 } // namespace libav
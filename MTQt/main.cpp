@@ -1,10 +1,43 @@
+#include "alloctrack.h"
+#include "analysis.h"
+#include "avdemuxer.h"
+#include "avringsource.h"
+#include "comparesession.h"
+#include "fileopener.h"
+#include "frameextractor.h"
+#include "latencypolicy.h"
 #include "mainwidget.h"
+#include "mediaindex.h"
 #include "libav.h"
+#include "quality.h"
+#include "rawvideoreader.h"
+#include "scopebands.h"
+#include "scoperenderer.h"
+#include "yuvconvert.h"
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
 
 
 
@@ -35,8 +68,893 @@ struct FrameCallbackHandler {
 
 };
 
+struct DiscardHandler {
+    bool stopped;
+    bool operator()(const libav::AVFrame& /*videoFrame*/, int /*index*/) { return true; }
+    bool operator()(const libav::AVSamples& /*audioSamples*/, int /*index*/) { return true; }
+};
+
+// Decodes a whole file into `callback`; .y4m files are read straight from a mapping.
+// `opened` learns the source frame rate (0 if unknown) before the first frame.
+// Returns the duration of the media in seconds.
+template< typename TCallback >
+static double DecodeFile(const char* fileName, TCallback& callback, const std::function<void(double)>& opened = nullptr)
+{
+    if (RawVideoReader::IsY4m(fileName)) {
+        std::unique_ptr<RawVideoReader> reader = RawVideoReader::OpenY4m(fileName);
+        if (! reader)
+            throw libav::AVError("unsupported y4m file");
+        if (opened)
+            opened(reader->GetFrameRate());
+        reader->Decode(callback);
+        return reader->GetDuration() / 1000000.0;
+    }
+
+    libav::AVInputFile inputFile(fileName);
+    if (opened)
+        opened(inputFile.GetFrameRate());
+    libav::AVStream fileStream(inputFile);
+    libav::AVDemuxer demuxer(inputFile, fileStream.GetStreamIndexes());
+    fileStream.SetPacketSource(&demuxer);
+    fileStream.Decode(callback);
+    return inputFile.GetDuration() / 1000000.0;
+}
+
+// Headless shot boundary listing: "<seconds> <cut|fade-in|fade-out> <score>" per line
+static int DetectScenes(const char* fileName)
+{
+    static const char* kTypeNames[] = { "cut", "fade-in", "fade-out" };
+
+    FrameAnalysis analysis;
+    analysis.EnableSceneDetection(true);
+
+    DiscardHandler discard;
+    AnalysisCallback<DiscardHandler> callback(discard, analysis);
+
+    const auto start = std::chrono::steady_clock::now();
+    const double duration = DecodeFile(fileName, callback);
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (const SceneCut& cut : analysis.GetSceneDetector()->GetCuts())
+        std::cout << cut.timestamp / 1000.0 << " " << kTypeNames[cut.type] << " " << cut.score << std::endl;
+    std::cerr << "analysed " << duration << " s in " << elapsed << " s" << std::endl;
+    return 0;
+}
+
+// Headless sidecar index creation, so the GUI can seek and show statistics right after opening
+static int BuildIndex(const char* fileName)
+{
+    libav::AVInputFile inputFile(fileName);
+    libav::AVStream fileStream(inputFile);
+    libav::AVDemuxer demuxer(inputFile, fileStream.GetStreamIndexes());
+    fileStream.SetPacketSource(&demuxer);
+    FrameAnalysis analysis;
+    analysis.EnableSceneDetection(true);
+    analysis.EnableIndexing(true);
+
+    DiscardHandler discard;
+    AnalysisCallback<DiscardHandler> callback(discard, analysis);
+    fileStream.Decode(callback);
+
+    const MediaIndexBuilder& builder = *analysis.GetIndexBuilder();
+    if (! builder.Save(fileName, inputFile.GetDuration())) {
+        std::cerr << "failed to write " << MediaIndex::SidecarName(fileName) << std::endl;
+        return 1;
+    }
+    std::cerr << "indexed " << builder.GetFrameCount() << " frames into " << MediaIndex::SidecarName(fileName) << std::endl;
+    return 0;
+}
+
+// Headless delivery QC, one CSV record per frame on stdout and a summary on stderr
+struct QcHandler {
+    bool stopped;
+    const QcAnalyzer& qc;
+    uint64_t analyzed; // frames the analyzer had counted after the previous call
+
+    QcHandler(const QcAnalyzer& analyzer) : stopped(false), qc(analyzer), analyzed(0) { }
+
+    bool operator()(const libav::AVFrame& /*videoFrame*/, int /*index*/) {
+        // The analysis stage has already run on this frame
+        if (qc.GetFrameCount() == analyzed)
+            return true; // format the analyzer cannot read
+        analyzed = qc.GetFrameCount();
+        const QcRecord& r = qc.GetLast();
+        std::cout << r.timestamp;
+        for (const QcPlane& plane : r.planes)
+            std::cout << "," << int(plane.min) << "," << int(plane.max) << "," << plane.mean << "," << plane.below << "," << plane.above;
+        std::cout << "," << r.darkRatio << "," << r.motion << "," << r.black << "," << r.frozen << "\n";
+        return true;
+    }
+
+    bool operator()(const libav::AVSamples& /*audioSamples*/, int /*index*/) { return true; }
+};
+
+static int CheckQuality(const char* fileName)
+{
+    FrameAnalysis analysis;
+    analysis.EnableQc(true);
+    const QcAnalyzer& qc = *analysis.GetQc();
+
+    std::cout << "timestamp_ms";
+    for (const char* plane : { "y", "u", "v" })
+        for (const char* column : { "min", "max", "mean", "below", "above" })
+            std::cout << "," << plane << "_" << column;
+    std::cout << ",dark_ratio,motion,black,frozen" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    QcHandler handler(qc);
+    AnalysisCallback<QcHandler> callback(handler, analysis);
+    const auto start = std::chrono::steady_clock::now();
+    const double duration = DecodeFile(fileName, callback);
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::flush;
+
+    std::cerr << qc.GetFrameCount() << " frames: " << qc.GetIllegalFrames() << " illegal, " << qc.GetBlackFrames() << " black, "
+              << qc.GetFrozenFrames() << " frozen; " << duration << " s checked in " << elapsed << " s ("
+              << (elapsed > 0 ? duration / elapsed : 0.0) << "x real time)" << std::endl;
+    return qc.GetIllegalFrames() ? 2 : 0;
+}
+
+// Headless audio levels: one CSV record per 100 ms on stdout, the programme loudness on stderr
+static void PrintLevel(double db)
+{
+    if (std::isinf(db))
+        std::cout << ",-inf";
+    else
+        std::cout << "," << db;
+}
+
+static int MeasureAudio(const char* fileName)
+{
+    FrameAnalysis analysis;
+    analysis.EnableAudioMeter(true);
+    AudioMeter& meter = *analysis.GetAudioMeter();
+
+    std::cout << std::fixed << std::setprecision(2);
+    meter.SetIntervalCallback([&meter](const AudioInterval& interval) {
+        if (meter.GetIntervalCount() == 1) {
+            std::cout << "timestamp_ms,momentary_lufs,short_term_lufs";
+            for (unsigned c = 0; c < interval.channels.size(); ++c)
+                std::cout << ",peak_" << c << ",true_peak_" << c << ",rms_" << c;
+            std::cout << "\n";
+        }
+        std::cout << interval.timestamp;
+        PrintLevel(interval.momentary);
+        PrintLevel(interval.shortTerm);
+        for (const AudioChannelLevels& levels : interval.channels) {
+            PrintLevel(AudioMeter::ToDb(levels.peak));
+            PrintLevel(AudioMeter::ToDb(levels.truePeak));
+            PrintLevel(AudioMeter::ToDb(levels.rms));
+        }
+        std::cout << "\n";
+    });
+
+    DiscardHandler discard;
+    AnalysisCallback<DiscardHandler> callback(discard, analysis);
+    const auto start = std::chrono::steady_clock::now();
+    const double duration = DecodeFile(fileName, callback);
+    meter.Finish();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::flush;
+
+    if (! meter.GetIntervalCount()) {
+        std::cerr << "no audio the meter can read" << std::endl;
+        return 1;
+    }
+    double truePeak = 0.0;
+    for (const AudioChannelLevels& levels : meter.GetProgram())
+        truePeak = std::max(truePeak, double(levels.truePeak));
+    std::cerr << std::fixed << std::setprecision(2) << meter.GetChannels() << " channels at " << meter.GetSampleRate() << " Hz: integrated "
+              << meter.GetIntegrated() << " LUFS, max momentary " << meter.GetMaxMomentary() << " LUFS, max short-term "
+              << meter.GetMaxShortTerm() << " LUFS, true peak " << AudioMeter::ToDb(truePeak) << " dBTP; " << duration
+              << " s measured in " << elapsed << " s" << std::endl;
+    return 0;
+}
+
+static std::unique_ptr<OpenedMedia> OpenMedia(const char* fileName)
+{
+    std::unique_ptr<OpenedMedia> media(new OpenedMedia());
+    media->fileName = fileName;
+    media->input.reset(new libav::AVInputFile(fileName));
+    media->stream.reset(new libav::AVStream(*media->input));
+    media->demuxer.reset(new libav::AVDemuxer(*media->input, media->stream->GetStreamIndexes()));
+    media->stream->SetPacketSource(media->demuxer.get());
+    return media;
+}
+
+// Headless A/B scoring, both files decode in parallel: "<frame>,<ms>,<mse>,<psnr>,<ssim>" per line
+static int CompareFiles(const char* referenceName, const char* distortedName)
+{
+    CompareSession session(OpenMedia(referenceName), OpenMedia(distortedName));
+
+    std::cout << "frame,timestamp_ms,mse,psnr_y,ssim_y" << std::endl;
+    std::cout << std::fixed << std::setprecision(4);
+    FramePair pair;
+    uint64_t frames = 0;
+    double psnr = 0.0, ssim = 0.0;
+    while (session.Next(pair)) {
+        const FrameQuality quality = QualityMeter::Measure(*pair.reference, *pair.distorted);
+        std::cout << frames << "," << quality.timestamp << "," << quality.mse << "," << quality.psnr << "," << quality.ssim << std::endl;
+        psnr += quality.psnr;
+        ssim += quality.ssim;
+        ++frames;
+    }
+
+    if (! frames) {
+        std::cerr << "no matching frames" << std::endl;
+        return 1;
+    }
+    std::cerr << frames << " frames, mean PSNR " << psnr / frames << " dB, mean SSIM " << ssim / frames
+              << ", " << session.GetUnmatched() << " unmatched" << std::endl;
+    return 0;
+}
+
+// Headless live feed check: reads a FIFO or UNIX socket until the writer goes away, drops
+// the frames that trail the quickest one by more than the latency bound like the player
+// does, and prints the counts once a second. With `bands` the scopes are counted from the
+// decoder's bands, and from the whole frame where the codec hands out none.
+struct LiveHandler {
+    LatencyPolicy& policy;
+    ScopeBands* bands;
+    std::unique_ptr<ScopeRenderer> waveform;    // for frames without bands
+    std::unique_ptr<ScopeRenderer> vectorscope;
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t droppedPackets;
+    int64_t maxLag;
+    uint64_t frameScopes;
+    double bandLead;  // milliseconds the band scopes were ready before the frame, summed
+    std::chrono::steady_clock::time_point lastReport;
+
+    LiveHandler(LatencyPolicy& p, ScopeBands* b)
+        : policy(p), bands(b), frames(0), dropped(0), droppedPackets(0), maxLag(0), frameScopes(0), bandLead(0.0)
+        , lastReport(std::chrono::steady_clock::now())
+    {
+        if (bands) {
+            waveform.reset(new ScopeRenderer(false, 512, 256, 1));
+            vectorscope.reset(new ScopeRenderer(true, 512, 256, 1));
+        }
+    }
+
+    // False if the frame is too late to be shown; the caller then skips ahead
+    bool Show(const libav::AVFrame& videoFrame) {
+        const auto now = std::chrono::steady_clock::now();
+        ++frames;
+        const bool admitted = policy.Admit(videoFrame.GetTimestamp());
+        maxLag = std::max(maxLag, policy.GetLastLag());
+        if (! admitted) {
+            ++dropped;
+        } else if (bands && bands->IsComplete(videoFrame)) {
+            bandLead += std::chrono::duration<double, std::milli>(now - bands->GetCompletedAt()).count();
+        } else if (bands) {
+            waveform->Render(videoFrame);
+            vectorscope->Render(videoFrame);
+            ++frameScopes;
+        }
+
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            std::cerr << videoFrame.GetTimestamp() / 1000.0 << " s: " << frames << " frames, " << dropped << " dropped ("
+                      << droppedPackets << " packets skipped), lag " << policy.GetLastLag() << " ms (max " << maxLag << " ms)";
+            if (bands) {
+                const uint64_t fromBands = frames - dropped - frameScopes;
+                std::cerr << "; scopes of " << fromBands << " frames from bands, ready "
+                          << (fromBands ? bandLead / fromBands : 0.0) << " ms before the frame, " << frameScopes << " from whole frames";
+            }
+            std::cerr << std::endl;
+            lastReport = now;
+        }
+        return admitted;
+    }
+};
+
+static int MonitorLive(const char* path, unsigned maxLatency, bool scopes)
+{
+    std::unique_ptr<ScopeBands> bands; // only with scopes, its renderers are not small
+    libav::AVOpenOptions options = FileOpener::LiveOptions();
+    if (scopes) {
+        bands.reset(new ScopeBands());
+        ScopeBands* const target = bands.get();
+        options.videoBands = [target](const libav::AVBand& band) { target->Feed(band); };
+    }
+    libav::AVRingBufferSource source(path);
+    libav::AVInputFile inputFile(source, path, options);
+    libav::AVStream liveStream(inputFile);
+    libav::AVDemuxer demuxer(inputFile, liveStream.GetStreamIndexes());
+    liveStream.SetPacketSource(&demuxer);
+    LatencyPolicy policy(maxLatency);
+    if (scopes && ! liveStream.HasVideoBands())
+        std::cerr << "the decoder hands out no bands, scopes are counted from whole frames" << std::endl;
+
+    // A late frame means the queued packets are stale too: resume at the newest keyframe
+    LiveHandler handler(policy, bands.get());
+    while (const libav::AVFrame* frame = liveStream.NextVideoFrame()) {
+        if (! handler.Show(*frame))
+            handler.droppedPackets += demuxer.SkipToLatestKeyframe(liveStream.GetStreamIndexes()[0]);
+    }
+    std::cerr << handler.frames << " frames, " << handler.dropped << " dropped over " << maxLatency << " ms ("
+              << handler.droppedPackets << " packets skipped), max lag " << handler.maxLag << " ms" << std::endl;
+    return 0;
+}
+
+// Headless scope archiving: one PNG per frame when `output` is a printf pattern
+// ("wave_%06d.png"), otherwise an elementary video stream chosen by its extension
+struct ScopeHandler {
+    bool stopped;
+    ScopeRenderer& renderer;
+    std::string pattern;
+    std::vector<char> name;
+    std::unique_ptr<libav::AVThumbnailEncoder> encoder;
+    FILE* output;
+    std::vector<uint8_t> packet;
+    uint64_t frames;
+
+    ScopeHandler(ScopeRenderer& r) : stopped(false), renderer(r), output(nullptr), packet(size_t(r.GetWidth()) * r.GetHeight() * 6 + 16384), frames(0) { }
+    ~ScopeHandler() { if (output) fclose(output); }
+
+    bool operator()(const libav::AVFrame& videoFrame, int /*index*/) {
+        const libav::AVTempFrame* scope = renderer.Render(videoFrame);
+        if (! scope)
+            return true;
+        const size_t size = encoder->Encode(packet.data(), packet.size(), *scope);
+        if (! pattern.empty()) {
+            // The sequence keeps one stream and its buffer, only the file behind it changes
+            snprintf(name.data(), name.size(), pattern.c_str(), int(frames));
+            output = output ? freopen(name.data(), "wb", output) : fopen(name.data(), "wb");
+            if (! output)
+                throw libav::AVError("fopen") << name.data();
+        }
+        fwrite(packet.data(), 1, size, output);
+        ++frames;
+        return true;
+    }
+
+    bool operator()(const libav::AVSamples& /*audioSamples*/, int /*index*/) { return true; }
+};
+
+static const char* ScopeCodec(const std::string& output)
+{
+    static const char* kCodecs[][2] = { { ".m1v", "mpeg1video" }, { ".m2v", "mpeg2video" }, { ".mjpeg", "mjpeg" }, { ".mjpg", "mjpeg" } };
+    for (const auto& codec : kCodecs) {
+        const size_t length = std::strlen(codec[0]);
+        if (output.size() > length && output.compare(output.size() - length, length, codec[0]) == 0)
+            return codec[1];
+    }
+    return nullptr;
+}
+
+static int RenderScopes(const char* fileName, const char* output, bool vectorscope)
+{
+    ScopeRenderer renderer(vectorscope);
+    ScopeHandler handler(renderer);
+    const char* codec = nullptr;
+    if (std::strchr(output, '%')) {
+        handler.pattern = output;
+        handler.name.resize(handler.pattern.size() + 32);
+        handler.encoder.reset(new libav::AVThumbnailEncoder("png", renderer.GetWidth(), renderer.GetHeight()));
+    } else {
+        codec = ScopeCodec(output);
+        if (! codec) {
+            std::cerr << "output must be a %d pattern or end in .m1v, .m2v or .mjpeg" << std::endl;
+            return 1;
+        }
+        handler.output = fopen(output, "wb");
+        if (! handler.output)
+            throw libav::AVError("fopen") << output;
+    }
+
+    // The scope video runs at the rate of its source
+    const auto opened = [&](double frameRate) {
+        if (codec)
+            handler.encoder.reset(new libav::AVThumbnailEncoder(codec, renderer.GetWidth(), renderer.GetHeight(), frameRate > 0.0 ? frameRate : 25.0));
+    };
+    const auto start = std::chrono::steady_clock::now();
+    const double duration = DecodeFile(fileName, handler, opened);
+    if (codec) {
+        while (const size_t size = handler.encoder->Flush(handler.packet.data(), handler.packet.size()))
+            fwrite(handler.packet.data(), 1, size, handler.output);
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << handler.frames << " scopes on " << renderer.GetThreadCount() << " threads; " << duration << " s rendered in "
+              << elapsed << " s (" << (elapsed > 0 ? duration / elapsed : 0.0) << "x real time)" << std::endl;
+    return handler.frames ? 0 : 1;
+}
+
+// Milliseconds per call of `convert`, repeated for at least a third of a second
+template< typename TConvert >
+static double TimeConversion(TConvert convert)
+{
+    const auto start = std::chrono::steady_clock::now();
+    unsigned calls = 0;
+    double elapsed = 0.0;
+    do {
+        convert();
+        ++calls;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 0.3 || calls < 3);
+    return elapsed * 1000.0 / calls;
+}
+
+// Whether two pictures of the same format and size are identical, padding aside;
+// otherwise `plane` and `row` tell where they first differ
+static bool SamePicture(const ::AVFrame& a, const ::AVFrame& b, unsigned& plane, unsigned& row)
+{
+    const ::PixelFormat format = static_cast< ::PixelFormat>(a.format);
+    const ::AVPixFmtDescriptor* desc = ::av_pix_fmt_desc_get(format);
+    for (plane = 0; plane < 4 && a.data[plane]; ++plane) {
+        const int bytes = ::av_image_get_linesize(format, a.width, plane);
+        const unsigned rows = plane == 1 || plane == 2 ? -((-a.height) >> desc->log2_chroma_h) : a.height;
+        for (row = 0; bytes > 0 && row < rows; ++row) {
+            const uint8_t* rowA = a.data[plane] + size_t(row) * a.linesize[plane];
+            if (! std::equal(rowA, rowA + bytes, b.data[plane] + size_t(row) * b.linesize[plane]))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Headless converter benchmark on a synthetic picture: the built-in kernels at every
+// level the CPU supports, split into bands on all cores, and swscale with each scaler,
+// in milliseconds per frame. The bands must reproduce the single pass exactly, for the
+// built-in kernels as well as for the swscale pairs that are split (same height); the
+// benchmark fails otherwise.
+static int BenchmarkConvert(unsigned width, unsigned height)
+{
+    enum Size { SAME, HALF, NARROW }; // NARROW: two thirds of the width, the same height
+    struct Case { ::PixelFormat src; ::PixelFormat dst; Size size; const char* name; };
+    static const Case kCases[] = {
+        { PIX_FMT_YUV420P, PIX_FMT_RGB24,   SAME,   "yuv420p>rgb24" },
+        { PIX_FMT_YUV420P, PIX_FMT_BGRA,    SAME,   "yuv420p>bgra" },
+        { PIX_FMT_NV12,    PIX_FMT_RGB24,   SAME,   "nv12>rgb24" },
+        { PIX_FMT_YUV420P, PIX_FMT_RGB24,   HALF,   "yuv420p>rgb24/2" },
+        { PIX_FMT_NV12,    PIX_FMT_BGRA,    HALF,   "nv12>bgra/2" },
+        { PIX_FMT_YUV422P, PIX_FMT_RGB24,   SAME,   "yuv422p>rgb24" },
+        { PIX_FMT_YUV444P, PIX_FMT_BGRA,    SAME,   "yuv444p>bgra" },
+        { PIX_FMT_YUYV422, PIX_FMT_RGB24,   SAME,   "yuyv422>rgb24" },
+        { PIX_FMT_YUV422P, PIX_FMT_RGB24,   NARROW, "yuv422p>rgb24/w" },
+        { PIX_FMT_YUV420P, PIX_FMT_YUV420P, NARROW, "yuv420p>yuv420p/w" },
+    };
+    static const int kFlags[] = { SWS_FAST_BILINEAR, SWS_BILINEAR, SWS_BICUBIC, SWS_POINT, SWS_AREA, SWS_SINC };
+    static const char* kFlagNames[] = { "fast_bilinear", "bilinear", "bicubic", "point", "area", "sinc" };
+
+    std::cout << "case";
+    libav::AVBandedConvert banded(std::max(std::thread::hardware_concurrency(), 1u));
+    for (int level = YuvConvert::LEVEL_SCALAR; level <= YuvConvert::GetBestLevel(); ++level)
+        std::cout << "," << YuvConvert::GetLevelName(YuvConvert::Level(level));
+    std::cout << ",banded_" << banded.GetThreadCount();
+    for (const char* name : kFlagNames)
+        std::cout << ",sws_" << name;
+    std::cout << std::endl << std::fixed << std::setprecision(3);
+
+    unsigned mismatches = 0;
+    for (const Case& test : kCases) {
+        libav::AVTempFrame source(libav::AVImageFormat(width, height, test.src));
+        ::AVFrame& s = *source.GetRaw();
+        const ::AVPixFmtDescriptor* desc = ::av_pix_fmt_desc_get(test.src);
+        for (unsigned plane = 0; plane < 3 && s.data[plane]; ++plane) {
+            const unsigned rows = plane ? -(-int(height) >> desc->log2_chroma_h) : height;
+            for (unsigned y = 0; y < rows; ++y)
+                for (int x = 0; x < s.linesize[plane]; ++x)
+                    s.data[plane][size_t(y) * s.linesize[plane] + x] = uint8_t(x * (plane + 1) + y * 3);
+        }
+        const unsigned dstWidth = test.size == HALF ? width / 2 : test.size == NARROW ? width * 2 / 3 : width;
+        const unsigned dstHeight = test.size == HALF ? height / 2 : height;
+        libav::AVTempFrame target(libav::AVImageFormat(dstWidth, dstHeight, test.dst));
+        ::AVFrame& d = *target.GetRaw();
+
+        // The single pass the bands are held against: the built-in kernels where they apply,
+        // otherwise swscale with the scaler AVBandedConvert uses
+        std::cout << test.name;
+        const bool builtIn = YuvConvert::Supports(s, d);
+        for (int level = YuvConvert::LEVEL_SCALAR; level <= YuvConvert::GetBestLevel(); ++level) {
+            YuvConvert::SetLevel(YuvConvert::Level(level));
+            std::cout << ",";
+            if (builtIn)
+                std::cout << TimeConversion([&]() { YuvConvert::Convert(s, d); });
+        }
+        YuvConvert::SetLevel(YuvConvert::GetBestLevel());
+        if (! builtIn) {
+            struct ::SwsContext* sws = ::sws_getCachedContext(nullptr, width, height, test.src, dstWidth, dstHeight, test.dst,
+                                                              SWS_SINC, nullptr, nullptr, nullptr);
+            if (! sws)
+                throw libav::AVError("sws_getCachedContext") << test.name;
+            ::sws_scale(sws, s.data, s.linesize, 0, height, d.data, d.linesize);
+            ::sws_freeContext(sws);
+        }
+
+        libav::AVTempFrame bands(libav::AVImageFormat(dstWidth, dstHeight, test.dst));
+        std::cout << ",";
+        if (banded.Convert(s, *bands.GetRaw())) {
+            std::cout << TimeConversion([&]() { banded.Convert(s, *bands.GetRaw()); });
+            unsigned plane = 0, row = 0;
+            if (! SamePicture(d, *bands.GetRaw(), plane, row)) {
+                std::cerr << test.name << ": banded output differs in plane " << plane << " at row " << row << std::endl;
+                ++mismatches;
+            }
+        }
+
+        for (int flags : kFlags) {
+            struct ::SwsContext* sws = ::sws_getCachedContext(nullptr, width, height, test.src, dstWidth, dstHeight, test.dst,
+                                                              flags, nullptr, nullptr, nullptr);
+            if (! sws) {
+                std::cout << ",";
+                continue;
+            }
+            std::cout << "," << TimeConversion([&]() { ::sws_scale(sws, s.data, s.linesize, 0, height, d.data, d.linesize); });
+            ::sws_freeContext(sws);
+        }
+        std::cout << std::endl;
+    }
+    if (mismatches)
+        std::cerr << mismatches << " of " << sizeof(kCases) / sizeof(kCases[0]) << " cases not identical in bands" << std::endl;
+    return mismatches ? 2 : 0;
+}
+
+// Encodes a synthetic clip, a moving gradient with a cut in the middle so that every
+// analysis stage has work, into a raw elementary stream. At the cut the luma drops to a
+// dark quarter of its range and the chroma swings, so the histograms tell the halves apart.
+static void EncodeClip(const char* fileName, const char* codec, unsigned width, unsigned height, double frameRate,
+                       unsigned gopSize, unsigned bFrames, unsigned frames)
+{
+    FILE* file = std::fopen(fileName, "wb");
+    if (! file)
+        throw libav::AVError("fopen") << fileName;
+
+    libav::AVThumbnailEncoder encoder(codec, width, height, frameRate, gopSize, bFrames);
+    libav::AVTempFrame picture(libav::AVImageFormat(width, height, PIX_FMT_YUV420P));
+    std::vector<uint8_t> packet(size_t(width) * height * 3 + 16384);
+    ::AVFrame& p = *picture.GetRaw();
+    for (unsigned i = 0; i < frames; ++i) {
+        const bool cut = i >= frames / 2;
+        for (unsigned plane = 0; plane < 3; ++plane) {
+            const unsigned w = plane ? width / 2 : width, h = plane ? height / 2 : height;
+            for (unsigned y = 0; y < h; ++y) {
+                for (unsigned x = 0; x < w; ++x) {
+                    const uint8_t luma = uint8_t(x + y + i * 4);
+                    p.data[plane][size_t(y) * p.linesize[plane] + x] = plane ? uint8_t(cut ? 88 : 168) : cut ? uint8_t(16 + luma / 4) : luma;
+                }
+            }
+        }
+        fwrite(packet.data(), 1, encoder.Encode(packet.data(), packet.size(), picture), file);
+    }
+    while (const size_t size = encoder.Flush(packet.data(), packet.size()))
+        fwrite(packet.data(), 1, size, file);
+    fclose(file);
+}
+
+// Encodes a short synthetic MPEG-1 clip into a temporary file and returns its name
+static std::string GenerateClip(unsigned width, unsigned height, unsigned frames)
+{
+    char name[] = "/tmp/mtqt-clip-XXXXXX.m1v";
+    const int fd = ::mkstemps(name, 4);
+    if (fd < 0)
+        throw libav::AVError("mkstemps");
+    ::close(fd);
+    EncodeClip(name, "mpeg1video", width, height, 25.0, 12, 0, frames);
+    return name;
+}
+
+// Headless steady-state allocation check: plays a clip through decode, conversion to RGB
+// and analysis, and fails if any stage but demuxing still allocates after the warm-up.
+// libavformat allocates every packet payload, so demuxing is only reported.
+static int CheckAllocations(const char* fileName)
+{
+    static const unsigned kWarmupFrames = 50;
+
+    if (! AllocTracker::IsEnabled()) {
+        std::cerr << "allocation tracking needs the build with CONFIG+=alloctrack" << std::endl;
+        return 1;
+    }
+    const std::string clip = fileName ? std::string(fileName) : GenerateClip(640, 360, 200);
+
+    libav::AVInputFile inputFile(clip.c_str());
+    libav::AVStream stream(inputFile);
+    FrameAnalysis analysis;
+    analysis.EnableSceneDetection(true);
+    analysis.EnableQc(true);
+    std::unique_ptr<libav::AVTempFrame> picture;
+
+    AllocTracker::Counts warm[AllocTracker::STAGE_COUNT];
+    unsigned frames = 0;
+    while (const libav::AVFrame* frame = stream.NextVideoFrame()) {
+        if (frames++ == kWarmupFrames) {
+            for (int stage = 0; stage < AllocTracker::STAGE_COUNT; ++stage)
+                warm[stage] = AllocTracker::Get(AllocTracker::Stage(stage));
+        }
+        analysis.Analyze(*frame);
+        if (picture && picture->GetWidth() == frame->GetWidth() && picture->GetHeight() == frame->GetHeight())
+            picture->ConvertFrom(*frame);
+        else
+            picture.reset(new libav::AVTempFrame(libav::AVImageFormat(frame->GetWidth(), frame->GetHeight(), PIX_FMT_RGB24), *frame));
+    }
+    if (! fileName)
+        std::remove(clip.c_str());
+    if (frames <= kWarmupFrames) {
+        std::cerr << "only " << frames << " frames, " << kWarmupFrames << " are needed for the warm-up" << std::endl;
+        return 1;
+    }
+
+    const unsigned measured = frames - kWarmupFrames;
+    bool steady = true;
+    std::cout << "stage,allocations_per_frame,av_allocations_per_frame,bytes_per_frame" << std::endl << std::fixed << std::setprecision(3);
+    for (int stage = 0; stage < AllocTracker::STAGE_COUNT; ++stage) {
+        const AllocTracker::Counts counts = AllocTracker::Get(AllocTracker::Stage(stage));
+        const uint64_t allocations = counts.allocations - warm[stage].allocations;
+        std::cout << AllocTracker::GetStageName(AllocTracker::Stage(stage)) << "," << double(allocations) / measured << ","
+                  << double(counts.avAllocations - warm[stage].avAllocations) / measured << ","
+                  << double(counts.bytes - warm[stage].bytes) / measured << std::endl;
+        if (allocations && stage != AllocTracker::STAGE_DEMUX)
+            steady = false;
+    }
+    // The generated clip has a cut in the middle; without it the scene stage did not really run
+    const size_t cuts = analysis.GetSceneDetector()->GetCuts().size();
+    const bool detected = fileName || cuts;
+    std::cerr << measured << " frames after " << kWarmupFrames << " of warm-up: "
+              << (steady ? "no allocations outside demuxing" : "STILL ALLOCATING") << ", " << cuts << " scene cuts"
+              << (detected ? "" : ", THE CUT WAS MISSED") << std::endl;
+    return steady && detected ? 0 : 2;
+}
+
+// The end-to-end benchmark corpus: codecs, GOP structures and frame rates from SD to 8K
+struct CorpusClip
+{
+    const char*  name;
+    const char*  codec;
+    unsigned     width;
+    unsigned     height;
+    double       frameRate;
+    unsigned     gopSize;
+    unsigned     bFrames;
+    unsigned     frames;
+};
+
+static const CorpusClip kCorpus[] = {
+    { "576p25-mpeg2-gop12-b2.m2v",    "mpeg2video",  720,  576, 25.0,   12,  2, 250 },
+    { "720p30-mpeg1-gop15.m1v",       "mpeg1video", 1280,  720, 29.97,  15,  0, 150 },
+    { "1080p25-mpeg2-gop12-b2.m2v",   "mpeg2video", 1920, 1080, 25.0,   12,  2, 125 },
+    { "1080p50-mpeg4-gop250.m4v",     "mpeg4",      1920, 1080, 50.0,  250,  0, 150 },
+    { "2160p25-mpeg4-gop25.m4v",      "mpeg4",      3840, 2160, 25.0,   25,  0,  50 },
+    { "2160p25-mjpeg-intra.mjpeg",    "mjpeg",      3840, 2160, 25.0,    1,  0,  50 },
+    { "4320p25-mjpeg-intra.mjpeg",    "mjpeg",      7680, 4320, 25.0,    1,  0,  25 },
+};
+
+// Stands in for the widgets: converts every frame to RGB like the display does, and
+// tracks when frames arrive
+class BenchSink : public IFrameSink
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit BenchSink(Clock::time_point start) : m_start(start), m_interval(0), m_shown(0), m_dropped(0) { }
+
+    void SetRefreshInterval(int milliseconds) { m_interval = milliseconds; }
+
+    void FeedFrame(const libav::AVFrame* frame) override
+    {
+        const Clock::time_point now = Clock::now();
+        if (! m_shown++) {
+            m_first = now;
+        } else if (m_interval) {
+            // Refreshes that passed without a new frame; the timer may be a little late, so
+            // only count whole intervals
+            const double gap = std::chrono::duration<double, std::milli>(now - m_last).count() / m_interval;
+            if (gap >= 1.5)
+                m_dropped += unsigned(gap + 0.5) - 1;
+        }
+        m_last = now;
+
+        if (m_picture && m_picture->GetWidth() == frame->GetWidth() && m_picture->GetHeight() == frame->GetHeight())
+            m_picture->ConvertFrom(*frame);
+        else
+            m_picture.reset(new libav::AVTempFrame(libav::AVImageFormat(frame->GetWidth(), frame->GetHeight(), PIX_FMT_RGB24), *frame));
+    }
+
+    double GetTimeToFirstFrame() const { return m_shown ? std::chrono::duration<double, std::milli>(m_first - m_start).count() : 0.0; }
+    unsigned GetShown() const { return m_shown; }
+    unsigned GetDropped() const { return m_dropped; }
+
+private:
+    const Clock::time_point               m_start;
+    Clock::time_point                     m_first;
+    Clock::time_point                     m_last;
+    int                                   m_interval; // milliseconds, 0 to not count drops
+    unsigned                              m_shown;
+    unsigned                              m_dropped;
+    std::unique_ptr<libav::AVTempFrame>   m_picture;
+};
+
+// Peak resident set size since the last reset, in KiB. The reset needs Linux 4.0; without
+// it the peak is the one of the whole process.
+static bool ResetPeakRss()
+{
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    return bool(clearRefs << "5" << std::flush);
+}
+
+static uint64_t GetPeakRss()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::strtoull(line.c_str() + 6, nullptr, 10);
+    }
+    struct rusage usage;
+    return ::getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+struct BenchPass
+{
+    double    timeToFirstFrame; // milliseconds
+    double    elapsed;          // seconds
+    uint64_t  decoded;
+    unsigned  shown;
+    unsigned  dropped;
+};
+
+// Plays a file through FrameExtractor the way the player does, for at most `seconds`
+static BenchPass RunBenchPass(const char* fileName, bool turbo, double seconds)
+{
+    std::remove(MediaIndex::SidecarName(fileName).c_str()); // every pass indexes from scratch
+
+    const BenchSink::Clock::time_point start = BenchSink::Clock::now();
+    const uint64_t decoded = PipelineStats::Instance().decodedFrames;
+    BenchSink sink(start);
+    FrameExtractor extractor(sink, OpenMedia(fileName));
+    // Besides the index (and the audio meter, where there is audio) every stage the player can run
+    FrameAnalysis& analysis = extractor.GetAnalysis();
+    analysis.EnableSceneDetection(true);
+    analysis.EnableQc(true);
+    extractor.SetTurbo(turbo);
+    if (! turbo)
+        sink.SetRefreshInterval(extractor.GetRefreshInterval());
+
+    double elapsed = 0.0;
+    while (! extractor.IsEnded() && elapsed < seconds) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        elapsed = std::chrono::duration<double>(BenchSink::Clock::now() - start).count();
+    }
+
+    std::remove(MediaIndex::SidecarName(fileName).c_str());
+    return BenchPass{ sink.GetTimeToFirstFrame(), elapsed, PipelineStats::Instance().decodedFrames - decoded,
+                      sink.GetShown(), sink.GetDropped() };
+}
+
+// Headless end-to-end benchmark over the corpus in `directory`, encoding the clips that are
+// missing. Each clip plays once in turbo mode for the sustained rate of decoding with scene
+// detection, QC and indexing, and once in real time, with the same analysis, for the first
+// frame delay and the refreshes missed.
+static int BenchmarkPipeline(const char* directory)
+{
+    static const double kRealTimeSeconds = 3.0;
+
+    if (! QDir().mkpath(QString::fromLocal8Bit(directory))) {
+        std::cerr << "cannot create " << directory << std::endl;
+        return 1;
+    }
+    const bool resettable = ResetPeakRss();
+    if (! resettable)
+        std::cerr << "peak RSS cannot be reset, it is reported for the whole run" << std::endl;
+
+    std::cout << "clip,codec,width,height,fps,gop,b_frames,frames,ttff_ms,decode_analysis_fps,realtime_shown,realtime_dropped,peak_rss_mib" << std::endl
+              << std::fixed;
+    bool failed = false;
+    for (const CorpusClip& clip : kCorpus) {
+        const std::string fileName = std::string(directory) + "/" + clip.name;
+        BenchPass turbo, realTime;
+        bool encoded = false;
+        try {
+            if (! QFile::exists(QString::fromLocal8Bit(fileName.c_str()))) {
+                encoded = true;
+                std::cerr << "encoding " << fileName << std::endl;
+                EncodeClip(fileName.c_str(), clip.codec, clip.width, clip.height, clip.frameRate, clip.gopSize, clip.bFrames, clip.frames);
+            }
+
+            if (resettable)
+                ResetPeakRss();
+            turbo = RunBenchPass(fileName.c_str(), true, 1e9);
+            realTime = RunBenchPass(fileName.c_str(), false, kRealTimeSeconds);
+        } catch (const std::exception&) {
+            // The codec may be missing from this libav build, the rest of the corpus still runs
+            std::cerr << std::endl << "skipping " << clip.name << std::endl;
+            if (encoded)
+                std::remove(fileName.c_str()); // not reused as a valid clip by the next run
+            failed = true;
+            continue;
+        }
+        const uint64_t peakRss = GetPeakRss();
+
+        std::cout << clip.name << "," << clip.codec << "," << clip.width << "," << clip.height << "," << std::setprecision(2)
+                  << clip.frameRate << "," << clip.gopSize << "," << clip.bFrames << "," << turbo.decoded << "," << std::setprecision(1)
+                  << realTime.timeToFirstFrame << "," << (turbo.elapsed > 0.0 ? turbo.decoded / turbo.elapsed : 0.0) << ","
+                  << realTime.shown << "," << realTime.dropped << "," << peakRss / 1024.0 << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc == 4 && std::strcmp(argv[1], "--compare") == 0) {
+        try {
+            return CompareFiles(argv[2], argv[3]);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+    const bool scopes = std::strcmp(argv[argc - 1], "--scopes") == 0;
+    if ((argc == 3 || argc == 4 || (argc == 5 && scopes)) && std::strcmp(argv[1], "--live") == 0) { // <path> [<max latency ms>] [--scopes]
+        const bool latency = argc - (scopes ? 1 : 0) == 4;
+        try {
+            return MonitorLive(argv[2], latency ? std::atoi(argv[3]) : 200, scopes);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
+    if (argc == 4 && (std::strcmp(argv[1], "--waveform") == 0 || std::strcmp(argv[1], "--vectorscope") == 0)) {
+        try {
+            return RenderScopes(argv[2], argv[3], std::strcmp(argv[1], "--vectorscope") == 0);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+    if ((argc == 2 || argc == 4) && std::strcmp(argv[1], "--bench-convert") == 0) { // [<width> <height>]
+        try {
+            return BenchmarkConvert(argc == 4 ? std::atoi(argv[2]) : 1920, argc == 4 ? std::atoi(argv[3]) : 1080);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+    if ((argc == 2 || argc == 3) && std::strcmp(argv[1], "--alloc-check") == 0) { // [<media>]
+        try {
+            return CheckAllocations(argc == 3 ? argv[2] : nullptr);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
+    if (argc == 3 && std::strcmp(argv[1], "--bench") == 0) { // <corpus directory>
+        QCoreApplication app(argc, argv); // timers and events, but no display
+        try {
+            return BenchmarkPipeline(argv[2]);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
+    if (argc == 3 && std::strcmp(argv[1], "--audio") == 0) {
+        try {
+            return MeasureAudio(argv[2]);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
+    if (argc == 3 && std::strcmp(argv[1], "--qc") == 0) {
+        try {
+            return CheckQuality(argv[2]);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+    if (argc == 3 && (std::strcmp(argv[1], "--scenes") == 0 || std::strcmp(argv[1], "--index") == 0)) {
+        try {
+            return std::strcmp(argv[1], "--scenes") == 0 ? DetectScenes(argv[2]) : BuildIndex(argv[2]);
+        } catch (const std::exception&) {
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
     QApplication a(argc, argv);
 
     /* Unit Test
@@ -48,6 +966,27 @@ int main(int argc, char *argv[])
 
     MainWidget w;
     w.show();
+    int first = 1; // QApplication holds on to argc, so leave it alone
+    while (first < argc) {
+        if (argc - first >= 3 && std::strcmp(argv[first], "--thumbnails") == 0) { // <cache MiB> <width>
+            w.SetThumbnailOptions(size_t(std::atoi(argv[first + 1])) << 20, std::atoi(argv[first + 2]));
+            first += 3;
+        } else if (argc - first >= 2 && std::strcmp(argv[first], "--frame-cache") == 0) { // <MiB>
+            w.SetFrameCacheBytes(size_t(std::atoi(argv[first + 1])) << 20);
+            first += 2;
+        } else if (argc - first >= 2 && std::strcmp(argv[first], "--convert-threads") == 0) { // <count>, 0 for all cores
+            const unsigned threads = std::atoi(argv[first + 1]);
+            libav::AVImageConvertCache::ForThread().SetThreads(threads ? threads : std::thread::hardware_concurrency());
+            first += 2;
+        } else if (argc - first >= 1 && std::strcmp(argv[first], "--preview") == 0) {
+            w.SetPreviewPlayback(true);
+            first += 1;
+        } else {
+            break;
+        }
+    }
+    if (argc == first + 1)
+        w.Open(QString::fromLocal8Bit(argv[first]));
 
     return a.exec();
 }
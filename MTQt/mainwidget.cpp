@@ -1,7 +1,11 @@
 #include "mainwidget.h"
+#include "compareextractor.h"
 #include "frameextractor.h"
+#include "glaudiometer.h"
 #include "glcanvas.h"
 #include "glwidget.h"
+#include "pipelinestats.h"
+#include "thumbnailcache.h"
 
 #include <QFileDialog>
 #include <QHBoxLayout>
@@ -11,20 +15,46 @@
 #include <algorithm>
 #include <fstream>
 
+static const uint64_t kSeekStepMs = 10000;
+static const size_t kThumbnailCacheBytes = 64 << 20;
+static const unsigned kThumbnailWidth = 160;
+static const size_t kFrameCacheBytes = size_t(256) << 20;
+static const qint64 kSummaryMs = 10000;
+
 MainWidget::MainWidget(QWidget* parent)
     : QWidget(parent)
-    , m_waveform(new GLWidget(false, this))
-    , m_vectorscope(new GLWidget(true, this))
     , m_canvas(new QGLCanvas(this))
-    , m_frameExtractor(new FrameExtractor(*this, "/Users/daniel/Movies/20150909_111119.mp4"))
+    , m_waveform(new GLWidget(false, this, m_canvas))
+    , m_vectorscope(new GLWidget(true, this, m_canvas))
+    , m_audioLevels(new GLAudioMeter(this))
+    , m_comparisonCanvas(new QGLCanvas(this, m_canvas))
+    , m_comparisonWaveform(new GLWidget(false, this, m_comparisonCanvas))
+    , m_comparisonVectorscope(new GLWidget(true, this, m_comparisonCanvas))
+    , m_thumbnails(new ThumbnailCache(kThumbnailCacheBytes))
+    , m_thumbnailWidth(kThumbnailWidth)
+    , m_frameCacheBytes(kFrameCacheBytes)
+    , m_previewPlayback(false)
+    , m_awaitingFirstFrame(false)
+    , m_statsFrames(0)
+    , m_statsAllocations(0)
+    , m_statsPosition(0)
+    , m_comparisonMeasuring(false)
+    , m_comparisonUnmatched(0)
 {
     m_waveform->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Preferred);
     m_vectorscope->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
+    m_audioLevels->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Preferred);
     m_canvas->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+    m_comparisonWaveform->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Preferred);
+    m_comparisonVectorscope->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
+    m_comparisonCanvas->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 
     m_waveform->setFocusPolicy(Qt::ClickFocus);
     m_vectorscope->setFocusPolicy(Qt::ClickFocus);
     m_canvas->setFocusPolicy(Qt::ClickFocus);
+    m_comparisonWaveform->setFocusPolicy(Qt::ClickFocus);
+    m_comparisonVectorscope->setFocusPolicy(Qt::ClickFocus);
+    m_comparisonCanvas->setFocusPolicy(Qt::ClickFocus);
 
     /*
     QHBoxLayout* horizontalVectorscope = QHBoxLayout();
@@ -39,10 +69,27 @@ MainWidget::MainWidget(QWidget* parent)
 
     QHBoxLayout* horizontal = new QHBoxLayout();
     horizontal->addLayout(vertical);
+    horizontal->addWidget(m_audioLevels);
     horizontal->addWidget(m_canvas);
 
-    setLayout(horizontal);
+    // Same arrangement for the distorted side of an A/B comparison, hidden otherwise
+    QVBoxLayout* comparisonVertical = new QVBoxLayout();
+    comparisonVertical->addWidget(m_comparisonWaveform);
+    comparisonVertical->addWidget(m_comparisonVectorscope);
+    comparisonVertical->setAlignment(Qt::AlignCenter);
+
+    QHBoxLayout* comparisonHorizontal = new QHBoxLayout();
+    comparisonHorizontal->addLayout(comparisonVertical);
+    comparisonHorizontal->addWidget(m_comparisonCanvas);
+
+    QVBoxLayout* rows = new QVBoxLayout();
+    rows->addLayout(horizontal);
+    rows->addLayout(comparisonHorizontal);
+    ShowComparison(false);
+
+    setLayout(rows);
     resize(1280, 720);
+    setWindowTitle(tr("Press O to open a video"));
 }
 
 MainWidget::~MainWidget()
@@ -52,17 +99,270 @@ MainWidget::~MainWidget()
 void MainWidget::keyPressEvent(QKeyEvent* keyEvent)
 {
     if (keyEvent->key() == Qt::Key_O) {
-        QString fileName = QFileDialog::getOpenFileName(this, tr("Open Video File"), "/Users/daniel",
+        QString fileName = QFileDialog::getOpenFileName(this, tr("Open Video File"), QString(),
+                                                        tr("Videos (*.mpg *.mp4 *.mkv *.m4v *.flv *.avi *.mov)"));
+        if (! fileName.isEmpty()) {
+            RestoreReference();
+            Open(fileName);
+        }
+    } else if (keyEvent->key() == Qt::Key_L && m_frameExtractor) {
+        const bool highlight = ! m_canvas->GetHighlightIllegal();
+        FrameAnalysis& analysis = m_frameExtractor->GetAnalysis();
+        if (! highlight && analysis.GetQc()) {
+            const QcAnalyzer& qc = *analysis.GetQc();
+            ShowSummary(tr("%1 frames checked, %2 with illegal levels, %3 black, %4 frozen").arg(qulonglong(qc.GetFrameCount()))
+                        .arg(qulonglong(qc.GetIllegalFrames())).arg(qulonglong(qc.GetBlackFrames())).arg(qulonglong(qc.GetFrozenFrames())));
+        }
+        analysis.EnableQc(highlight || m_frameExtractor->IsTurbo());
+        m_canvas->SetHighlightIllegal(highlight);
+    } else if (keyEvent->key() == Qt::Key_C && m_frameExtractor && ! m_opener) {
+        QString fileName = QFileDialog::getOpenFileName(this, tr("Compare Against"), QString(),
                                                         tr("Videos (*.mpg *.mp4 *.mkv *.m4v *.flv *.avi *.mov)"));
         if (! fileName.isEmpty())
-            m_frameExtractor.reset(new FrameExtractor(*this, fileName.toStdString().c_str()));
+            OpenComparison(fileName);
+    } else if (keyEvent->key() == Qt::Key_D && m_compareExtractor) {
+        m_compareExtractor->SetShowDifference(! m_compareExtractor->IsShowingDifference());
+    } else if (keyEvent->key() == Qt::Key_M && m_compareExtractor) {
+        m_compareExtractor->SetMeasuring(! m_compareExtractor->IsMeasuring());
+    } else if (keyEvent->key() == Qt::Key_Escape && m_opener) {
+        m_opener.reset(); // cancels and waits for the background thread
+        RestoreReference();
+        setWindowTitle(tr("Open cancelled"));
+    } else if (keyEvent->key() == Qt::Key_BracketLeft && m_frameExtractor) {
+        const uint64_t position = m_frameExtractor->GetPosition();
+        Scrub(position > kSeekStepMs ? position - kSeekStepMs : 0);
+    } else if (keyEvent->key() == Qt::Key_BracketRight && m_frameExtractor) {
+        Scrub(m_frameExtractor->GetPosition() + kSeekStepMs);
+    } else if (keyEvent->key() == Qt::Key_Space && m_frameExtractor) {
+        m_frameExtractor->SetPaused(! m_frameExtractor->IsPaused());
+    } else if (keyEvent->key() == Qt::Key_Comma && m_frameExtractor) {
+        m_frameExtractor->StepBackward();
+    } else if (keyEvent->key() == Qt::Key_Period && m_frameExtractor) {
+        m_frameExtractor->StepForward();
+    } else if (keyEvent->key() == Qt::Key_P && m_frameExtractor) {
+        SetPreviewPlayback(! m_previewPlayback);
+    } else if (keyEvent->key() == Qt::Key_S && m_frameExtractor) {
+        FrameAnalysis& analysis = m_frameExtractor->GetAnalysis();
+        if (const SceneDetector* detector = analysis.GetSceneDetector()) {
+            static const char* kTypeNames[] = { "cut", "fade-in", "fade-out" };
+            const std::vector<SceneCut>& cuts = detector->GetCuts();
+            QString summary = tr("%1 scene changes").arg(qulonglong(cuts.size()));
+            for (size_t i = cuts.size() > 5 ? cuts.size() - 5 : 0; i < cuts.size(); ++i)
+                summary += tr(", %1 at %2 s").arg(kTypeNames[cuts[i].type]).arg(cuts[i].timestamp / 1000.0, 0, 'f', 2);
+            ShowSummary(summary);
+            analysis.EnableSceneDetection(false);
+        } else {
+            analysis.EnableSceneDetection(true);
+        }
+    } else if (keyEvent->key() == Qt::Key_F && m_frameExtractor) {
+        // Turbo runs the QC on every frame; it stays on afterwards while illegal levels are highlighted
+        const bool turbo = ! m_frameExtractor->IsTurbo();
+        FrameAnalysis& analysis = m_frameExtractor->GetAnalysis();
+        if (! turbo && analysis.GetQc()) {
+            const QcAnalyzer& qc = *analysis.GetQc();
+            ShowSummary(tr("%1 frames, luma %2-%3 mean %4, %5 out of legal range").arg(qulonglong(qc.GetFrameCount()))
+                        .arg(qc.GetMinLuma()).arg(qc.GetMaxLuma()).arg(qc.GetMeanLuma(), 0, 'f', 1).arg(qulonglong(qc.GetIllegalFrames())));
+        }
+        analysis.EnableQc(turbo || m_canvas->GetHighlightIllegal());
+        m_frameExtractor->SetTurbo(turbo);
     }
     return QWidget::keyPressEvent(keyEvent);
 }
 
+void MainWidget::Open(const QString& fileName)
+{
+    m_openRequested = std::chrono::steady_clock::now();
+    m_awaitingFirstFrame = false;
+    const std::string name = fileName.toStdString();
+    const bool live = libav::AVRingBufferSource::IsStreamingPath(name.c_str());
+    m_opener.reset(new FileOpener(name, live ? FileOpener::LiveOptions() : FileOpener::InteractiveOptions()));
+    connect(m_opener.get(), SIGNAL(Progress(int, QString)), this, SLOT(OnOpenProgress(int, QString)));
+    connect(m_opener.get(), SIGNAL(Opened()), this, SLOT(OnOpened()));
+    connect(m_opener.get(), SIGNAL(Failed(QString)), this, SLOT(OnOpenFailed(QString)));
+    m_opener->Start();
+}
+
+void MainWidget::OpenComparison(const QString& fileName)
+{
+    if (! m_frameExtractor)
+        return;
+    m_reference = m_frameExtractor->TakeMedia();
+    m_frameExtractor.reset();
+    m_reference->stream->Seek(0); // both sides start from their first frame
+    Open(fileName);
+}
+
+void MainWidget::SetThumbnailOptions(size_t maxBytes, unsigned width)
+{
+    m_thumbnails->SetMaxBytes(maxBytes);
+    m_thumbnailWidth = width;
+}
+
+void MainWidget::SetFrameCacheBytes(size_t maxBytes)
+{
+    m_frameCacheBytes = maxBytes;
+    if (m_frameExtractor)
+        m_frameExtractor->GetFrameCache().SetMaxBytes(maxBytes);
+}
+
+void MainWidget::SetPreviewPlayback(bool preview)
+{
+    m_previewPlayback = preview;
+    if (m_frameExtractor)
+        m_frameExtractor->SetPreviewPlayback(preview);
+}
+
+// Shows the nearest keyframe thumbnail at once; the exact frame replaces it when decoded
+// (right away when paused)
+void MainWidget::Scrub(uint64_t timestamp)
+{
+    if ((m_scrubPicture = m_thumbnails->FindNearest(timestamp)))
+        m_canvas->FeedFrame(m_scrubPicture.get());
+    m_frameExtractor->Seek(timestamp);
+}
+
+void MainWidget::StartPlayback(std::unique_ptr<OpenedMedia> media)
+{
+    m_frameExtractor.reset(new FrameExtractor(*this, std::move(media)));
+    m_frameExtractor->GetFrameCache().SetMaxBytes(m_frameCacheBytes);
+    m_frameExtractor->SetPreviewPlayback(m_previewPlayback);
+}
+
+// Goes back to plain playback of the reference if the comparison file did not open
+void MainWidget::RestoreReference()
+{
+    if (m_reference)
+        StartPlayback(std::move(m_reference));
+}
+
+void MainWidget::ShowComparison(bool show)
+{
+    m_comparisonWaveform->setVisible(show);
+    m_comparisonVectorscope->setVisible(show);
+    m_comparisonCanvas->setVisible(show);
+}
+
+// The result of an analysis that was just switched off; it leads the window title for a while
+void MainWidget::ShowSummary(const QString& summary)
+{
+    m_summary = summary;
+    m_summaryTimer.start();
+    setWindowTitle(summary);
+}
+
+// Signals of a replaced or cancelled opener may still be queued, only the current one counts
+void MainWidget::OnOpenProgress(int percent, QString stage)
+{
+    if (! m_opener || sender() != m_opener.get())
+        return;
+    setWindowTitle(tr("Opening: %1 (%2%)").arg(stage).arg(percent));
+}
+
+void MainWidget::OnOpened()
+{
+    if (! m_opener || sender() != m_opener.get())
+        return;
+    std::unique_ptr<OpenedMedia> media = m_opener->TakeMedia();
+    m_opener.release()->deleteLater(); // we are inside one of its signals
+    m_awaitingFirstFrame = true;
+    if (m_reference) {
+        m_compareExtractor.reset(new CompareExtractor(*this, std::move(m_reference), std::move(media)));
+        ShowComparison(true);
+    } else {
+        m_compareExtractor.reset();
+        ShowComparison(false);
+        m_thumbnailBuilder.reset();
+        m_thumbnails->Clear();
+        if (! media->IsLive())
+            m_thumbnailBuilder.reset(new ThumbnailBuilder(media->fileName, *m_thumbnails, m_thumbnailWidth));
+        StartPlayback(std::move(media));
+    }
+}
+
+void MainWidget::OnOpenFailed(QString reason)
+{
+    if (! m_opener || sender() != m_opener.get())
+        return;
+    m_opener.release()->deleteLater();
+    RestoreReference();
+    setWindowTitle(reason);
+}
+
+void MainWidget::FeedComparison(const libav::AVFrame* picture, const libav::AVFrame* frame, const FrameQuality* quality)
+{
+    // The scopes only sample the canvas's planes when it shows the frame itself, not a difference picture
+    const uint64_t serial = m_comparisonCanvas->FeedFrame(picture);
+    m_comparisonWaveform->FeedFrame(frame, picture == frame ? serial : 0);
+    m_comparisonVectorscope->FeedFrame(frame, picture == frame ? serial : 0);
+
+    // The scores join the stats in the title; only a change of the comparison state refreshes it early
+    const uint64_t unmatched = m_compareExtractor->GetSession().GetUnmatched();
+    m_comparisonScores = quality ? tr("PSNR %1 dB, SSIM %2").arg(quality->psnr, 0, 'f', 2).arg(quality->ssim, 0, 'f', 4) : QString();
+    if ((quality != nullptr) != m_comparisonMeasuring || unmatched != m_comparisonUnmatched) {
+        m_comparisonMeasuring = quality != nullptr;
+        m_comparisonUnmatched = unmatched;
+        m_statsTimer.invalidate();
+    }
+}
+
 void MainWidget::FeedFrame(const libav::AVFrame* frame)
 {
-    m_canvas->FeedFrame(frame);
-    m_waveform->FeedFrame(frame);
-    m_vectorscope->FeedFrame(frame);
+    AllocTracker::Scope stage(AllocTracker::STAGE_DISPLAY);
+    if (m_awaitingFirstFrame) {
+        PipelineStats::Instance().timeToFirstFrame.Add(std::chrono::steady_clock::now() - m_openRequested);
+        m_awaitingFirstFrame = false;
+        m_statsTimer.invalidate();
+    }
+
+    const uint64_t serial = m_canvas->FeedFrame(frame);
+    m_waveform->FeedFrame(frame, serial);
+    m_vectorscope->FeedFrame(frame, serial);
+    const ScopeBands* bands = m_frameExtractor ? m_frameExtractor->GetScopeBands() : nullptr;
+    m_waveform->FeedScope(bands ? bands->GetWaveform(*frame) : nullptr);
+    m_vectorscope->FeedScope(bands ? bands->GetVectorscope(*frame) : nullptr);
+    m_audioLevels->FeedLevels(m_frameExtractor ? m_frameExtractor->GetAnalysis().GetAudioMeter() : nullptr);
+
+    if (! m_statsTimer.isValid() || m_statsTimer.elapsed() > 1000) {
+        QString title = QString::fromStdString(PipelineStats::Instance().Report());
+
+        // Decode throughput, and how much faster than real time that is
+        const uint64_t frames = PipelineStats::Instance().decodedFrames;
+        const uint64_t position = frame->GetTimestamp();
+        if (m_statsTimer.isValid() && m_statsTimer.elapsed() > 0 && frames >= m_statsFrames && position >= m_statsPosition) {
+            const double seconds = m_statsTimer.elapsed() / 1000.0;
+            title += tr(", %1 fps (%2x)").arg((frames - m_statsFrames) / seconds, 0, 'f', 1)
+                                          .arg((position - m_statsPosition) / 1000.0 / seconds, 0, 'f', 1);
+        }
+        const uint64_t allocations = AllocTracker::GetTotal().allocations;
+        if (AllocTracker::IsEnabled() && frames > m_statsFrames)
+            title += tr(", %1 allocations/frame").arg(double(allocations - m_statsAllocations) / (frames - m_statsFrames), 0, 'f', 1);
+        m_statsAllocations = allocations;
+        m_statsFrames = frames;
+        m_statsPosition = position;
+        if (frame->IsPreview())
+            title += frame->GetLowres() ? tr(", PREVIEW 1/%1").arg(1 << frame->GetLowres()) : tr(", PREVIEW");
+
+        const QcAnalyzer* qc = m_frameExtractor ? m_frameExtractor->GetAnalysis().GetQc() : nullptr;
+        if (qc && qc->GetFrameCount()) {
+            const QcRecord& record = qc->GetLast();
+            title += tr(", Y %1-%2 U %3-%4 V %5-%6").arg(record.planes[0].min).arg(record.planes[0].max)
+                     .arg(record.planes[1].min).arg(record.planes[1].max).arg(record.planes[2].min).arg(record.planes[2].max);
+            if (record.IsIllegal())
+                title += tr(" ILLEGAL");
+            if (record.black)
+                title += tr(" BLACK");
+            if (record.frozen)
+                title += tr(" FROZEN");
+        }
+
+        if (m_compareExtractor) {
+            if (m_comparisonMeasuring)
+                title += tr(", %1").arg(m_comparisonScores);
+            title += tr(", %1 unmatched frames").arg(qulonglong(m_comparisonUnmatched));
+        }
+        if (m_summaryTimer.isValid() && m_summaryTimer.elapsed() < kSummaryMs)
+            title = m_summary + " | " + title;
+        setWindowTitle(title);
+        m_statsTimer.restart();
+    }
 }
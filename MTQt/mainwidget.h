@@ -1,17 +1,28 @@
 #pragma once
 
+#include "framesink.h"
 #include "libav.h"
 
+#include <QElapsedTimer>
+#include <QString>
 #include <QWidget>
 
+#include <chrono>
 #include <memory>
 
+class CompareExtractor;
+class FileOpener;
 class FrameExtractor;
+class GLAudioMeter;
+struct FrameQuality;
+struct OpenedMedia;
 class QGLCanvas;
 class GLWidget;
 class QKeyEvent;
+class ThumbnailBuilder;
+class ThumbnailCache;
 
-class MainWidget : public QWidget
+class MainWidget : public QWidget, public IFrameSink
 {
     Q_OBJECT
 
@@ -19,14 +30,55 @@ public:
     MainWidget(QWidget* parent = nullptr);
     ~MainWidget();
 
-    void FeedFrame(const libav::AVFrame* frame);
+    void FeedFrame(const libav::AVFrame* frame) override;
+    // `picture` goes to the second canvas, `frame` to the second set of scopes
+    void FeedComparison(const libav::AVFrame* picture, const libav::AVFrame* frame, const FrameQuality* quality);
+    void Open(const QString& fileName);
+    void OpenComparison(const QString& fileName); // against the file that is currently open
+    void SetThumbnailOptions(size_t maxBytes, unsigned width); // applies to files opened afterwards
+    void SetFrameCacheBytes(size_t maxBytes);
+    void SetPreviewPlayback(bool preview); // low quality decode while playing, full quality when paused
+
+private slots:
+    void OnOpenProgress(int percent, QString stage);
+    void OnOpened();
+    void OnOpenFailed(QString reason);
 
 private:
     void keyPressEvent(QKeyEvent* keyEvent);
+    void ShowComparison(bool show);
+    void RestoreReference();
+    void Scrub(uint64_t timestamp);
+    void ShowSummary(const QString& summary);
+    void StartPlayback(std::unique_ptr<OpenedMedia> media);
 
 private:
+    QGLCanvas* m_canvas; // first, every other GL widget joins its share group
     GLWidget* m_waveform;
     GLWidget* m_vectorscope;
-    QGLCanvas* m_canvas;
+    GLAudioMeter* m_audioLevels; // of the file playing, beside its scopes
+    QGLCanvas* m_comparisonCanvas;
+    GLWidget* m_comparisonWaveform;
+    GLWidget* m_comparisonVectorscope;
     std::unique_ptr<FrameExtractor> m_frameExtractor;
+    std::unique_ptr<CompareExtractor> m_compareExtractor;
+    std::unique_ptr<OpenedMedia> m_reference; // waits for the comparison file to open
+    std::unique_ptr<FileOpener> m_opener;
+    std::unique_ptr<ThumbnailCache> m_thumbnails;
+    std::unique_ptr<ThumbnailBuilder> m_thumbnailBuilder; // fills m_thumbnails, so declared after it
+    std::shared_ptr<const libav::AVTempFrame> m_scrubPicture; // shown until the exact frame is decoded
+    unsigned m_thumbnailWidth;
+    size_t m_frameCacheBytes;
+    bool m_previewPlayback;
+    std::chrono::steady_clock::time_point m_openRequested;
+    bool m_awaitingFirstFrame;
+    QElapsedTimer m_statsTimer;
+    uint64_t m_statsFrames;   // decoded frame count at the last stats update
+    uint64_t m_statsAllocations;
+    uint64_t m_statsPosition; // milliseconds
+    QString m_comparisonScores; // of the last compared frame
+    bool m_comparisonMeasuring;
+    uint64_t m_comparisonUnmatched;
+    QString m_summary;
+    QElapsedTimer m_summaryTimer;
 };
@@ -0,0 +1,207 @@
+#include "mediaindex.h"
+#include "scenedetector.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(MediaIndexHeader) % 8 == 0, "index header must keep the tables aligned");
+static_assert(sizeof(MediaIndexKeyframe) == 24, "keyframe records are part of the file format");
+static_assert(sizeof(MediaIndexFrame) == 32, "frame records are part of the file format");
+
+static const char kMagic[8] = { 'M', 'T', 'Q', 'I', 'D', 'X', 0, 0 };
+static const size_t kHashedBytes = 64 * 1024;
+static const unsigned kLumaRowStep = 4;
+
+static uint64_t Fnv1a(uint64_t hash, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool MediaIndexKey::FromFile(const char* fileName, MediaIndexKey& key)
+{
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    key.fileSize = st.st_size;
+    key.mtime = st.st_mtime;
+
+    std::vector<uint8_t> buffer(kHashedBytes);
+    uint64_t hash = Fnv1a(14695981039346656037ULL, reinterpret_cast<const uint8_t*>(&key.fileSize), sizeof(key.fileSize));
+    ssize_t head = ::pread(fd, buffer.data(), buffer.size(), 0);
+    if (head > 0)
+        hash = Fnv1a(hash, buffer.data(), head);
+    if (key.fileSize > kHashedBytes) {
+        ssize_t tail = ::pread(fd, buffer.data(), buffer.size(), key.fileSize - kHashedBytes);
+        if (tail > 0)
+            hash = Fnv1a(hash, buffer.data(), tail);
+    }
+    key.contentHash = hash;
+
+    ::close(fd);
+    return head >= 0;
+}
+
+
+MediaIndex::MediaIndex(void* mapping, size_t size)
+    : m_mapping(mapping)
+    , m_size(size)
+    , m_header(static_cast<const MediaIndexHeader*>(mapping))
+    , m_keyframes(reinterpret_cast<const MediaIndexKeyframe*>(static_cast<const uint8_t*>(mapping) + m_header->keyframeOffset))
+    , m_frames(reinterpret_cast<const MediaIndexFrame*>(static_cast<const uint8_t*>(mapping) + m_header->frameOffset))
+{
+}
+
+MediaIndex::~MediaIndex()
+{
+    ::munmap(m_mapping, m_size);
+}
+
+std::string MediaIndex::SidecarName(const char* mediaFileName)
+{
+    return std::string(mediaFileName) + ".mtqidx";
+}
+
+std::unique_ptr<MediaIndex> MediaIndex::Open(const char* mediaFileName)
+{
+    MediaIndexKey key;
+    if (! MediaIndexKey::FromFile(mediaFileName, key))
+        return nullptr;
+
+    int fd = ::open(SidecarName(mediaFileName).c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(MediaIndexHeader))
+        mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    const size_t size = st.st_size;
+    const MediaIndexHeader& header = *static_cast<const MediaIndexHeader*>(mapping);
+    const bool valid = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+        && header.version == MediaIndexHeader::VERSION
+        && header.headerSize == sizeof(MediaIndexHeader)
+        && header.key == key
+        && header.keyframeOffset % 8 == 0 && header.frameOffset % 8 == 0
+        && header.keyframeOffset + uint64_t(header.keyframeCount) * sizeof(MediaIndexKeyframe) <= size
+        && header.frameOffset + uint64_t(header.frameCount) * sizeof(MediaIndexFrame) <= size;
+    if (! valid) {
+        ::munmap(mapping, size);
+        return nullptr;
+    }
+    return std::unique_ptr<MediaIndex>(new MediaIndex(mapping, size));
+}
+
+const MediaIndexKeyframe* MediaIndex::FindKeyframe(uint64_t timestamp) const
+{
+    const MediaIndexKeyframe* end = m_keyframes + GetKeyframeCount();
+    const MediaIndexKeyframe* it = std::upper_bound(m_keyframes, end, timestamp,
+        [](uint64_t t, const MediaIndexKeyframe& k) { return t < k.timestamp; });
+    return it == m_keyframes ? nullptr : it - 1;
+}
+
+const MediaIndexFrame* MediaIndex::FindFrame(uint64_t timestamp) const
+{
+    const MediaIndexFrame* end = m_frames + GetFrameCount();
+    const MediaIndexFrame* it = std::upper_bound(m_frames, end, timestamp,
+        [](uint64_t t, const MediaIndexFrame& f) { return t < f.timestamp; });
+    return it == m_frames ? nullptr : it - 1;
+}
+
+
+MediaIndexBuilder::MediaIndexBuilder()
+    : m_timeBase(1.0)
+    , m_timeOffset(0)
+    , m_valid(true)
+{
+}
+
+void MediaIndexBuilder::Add(const libav::AVFrame& frame, double sceneScore)
+{
+    if (! m_valid)
+        return;
+    if (m_frames.empty()) {
+        m_timeBase = frame.GetTimeBase();
+        m_timeOffset = frame.GetTimeOffset();
+    }
+
+    // Mean luma over every few rows is enough for a timeline overview
+    const unsigned width = frame.GetWidth();
+    uint64_t sum = 0;
+    unsigned rows = 0;
+    for (unsigned y = 0; y < frame.GetHeight(); y += kLumaRowStep, ++rows)
+        sum += SceneDetector::SumOfBytes(frame.GetPlane(0) + size_t(y) * frame.GetLineSize(0), width);
+
+    MediaIndexFrame record;
+    record.timestamp = frame.GetTimestamp();
+    record.sourceTimestamp = frame.GetSourceTimestamp();
+    record.meanLuma = rows && width ? float(double(sum) / (double(rows) * width)) : 0.0f;
+    record.sceneScore = float(sceneScore);
+    record.flags = (frame.IsKey() ? MediaIndexFrame::KEY : 0) | (sceneScore > 0.0 ? MediaIndexFrame::SCENE_CUT : 0);
+    record.reserved = 0;
+
+    if (frame.IsKey()) {
+        MediaIndexKeyframe keyframe;
+        keyframe.timestamp = record.timestamp;
+        keyframe.sourceTimestamp = record.sourceTimestamp;
+        keyframe.frameNumber = m_frames.size();
+        keyframe.reserved = 0;
+        m_keyframes.push_back(keyframe);
+    }
+    m_frames.push_back(record);
+}
+
+bool MediaIndexBuilder::Save(const char* mediaFileName, uint64_t duration) const
+{
+    MediaIndexKey key;
+    if (! m_valid || m_frames.empty() || ! MediaIndexKey::FromFile(mediaFileName, key))
+        return false;
+
+    MediaIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = MediaIndexHeader::VERSION;
+    header.headerSize = sizeof(MediaIndexHeader);
+    header.key = key;
+    header.duration = duration;
+    header.timeBase = m_timeBase;
+    header.timeOffset = m_timeOffset;
+    header.keyframeCount = m_keyframes.size();
+    header.frameCount = m_frames.size();
+    header.keyframeOffset = sizeof(MediaIndexHeader);
+    header.frameOffset = header.keyframeOffset + m_keyframes.size() * sizeof(MediaIndexKeyframe);
+
+    // Write next to the media and rename, so a reader never maps a half written index
+    const std::string name = MediaIndex::SidecarName(mediaFileName);
+    const std::string temporary = name + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(m_keyframes.data()), m_keyframes.size() * sizeof(MediaIndexKeyframe));
+        out.write(reinterpret_cast<const char*>(m_frames.data()), m_frames.size() * sizeof(MediaIndexFrame));
+        if (! out)
+            return false;
+    }
+    return std::rename(temporary.c_str(), name.c_str()) == 0;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Identifies the exact media file an index was built from
+struct MediaIndexKey
+{
+    uint64_t  fileSize;
+    int64_t   mtime;
+    uint64_t  contentHash; // FNV-1a over the size and the first and last 64 KiB
+
+    static bool FromFile(const char* fileName, MediaIndexKey& key);
+
+    bool operator==(const MediaIndexKey& other) const
+    {
+        return fileSize == other.fileSize && mtime == other.mtime && contentHash == other.contentHash;
+    }
+};
+
+
+// On-disk layout. Every record is 8 byte aligned so the tables can be used in place from the mapping.
+struct MediaIndexHeader
+{
+    static const uint32_t VERSION = 1;
+
+    char           magic[8];       // "MTQIDX\0\0"
+    uint32_t       version;
+    uint32_t       headerSize;
+    MediaIndexKey  key;
+    uint64_t       duration;       // microseconds
+    double         timeBase;       // seconds per source timestamp unit
+    uint64_t       timeOffset;     // milliseconds, timestamp of the first frame
+    uint32_t       keyframeCount;
+    uint32_t       frameCount;
+    uint64_t       keyframeOffset; // bytes from the start of the file
+    uint64_t       frameOffset;
+};
+
+struct MediaIndexKeyframe
+{
+    uint64_t  timestamp;        // milliseconds
+    int64_t   sourceTimestamp;  // stream time base, what the demuxer seeks to
+    uint32_t  frameNumber;
+    uint32_t  reserved;
+};
+
+struct MediaIndexFrame
+{
+    enum Flags {
+        KEY = 1,
+        SCENE_CUT = 2
+    };
+
+    uint64_t  timestamp;        // milliseconds
+    int64_t   sourceTimestamp;
+    float     meanLuma;
+    float     sceneScore;       // 0 unless the frame starts a new shot
+    uint32_t  flags;
+    uint32_t  reserved;
+};
+
+
+// Read-only view of a sidecar index mapped into memory
+class MediaIndex : NoCopy
+{
+public:
+    ~MediaIndex();
+
+    // Returns nullptr if there is no index or it was built for another version of the file
+    static std::unique_ptr<MediaIndex> Open(const char* mediaFileName);
+    static std::string SidecarName(const char* mediaFileName);
+
+    const MediaIndexHeader& GetHeader() const { return *m_header; }
+
+    const MediaIndexKeyframe* GetKeyframes() const { return m_keyframes; }
+    uint32_t GetKeyframeCount() const { return m_header->keyframeCount; }
+    const MediaIndexFrame* GetFrames() const { return m_frames; }
+    uint32_t GetFrameCount() const { return m_header->frameCount; }
+
+    // Last keyframe at or before the timestamp (milliseconds), nullptr if there is none
+    const MediaIndexKeyframe* FindKeyframe(uint64_t timestamp) const;
+    const MediaIndexFrame* FindFrame(uint64_t timestamp) const;
+
+private:
+    MediaIndex(void* mapping, size_t size);
+
+    void*                      m_mapping;
+    size_t                     m_size;
+    const MediaIndexHeader*    m_header;
+    const MediaIndexKeyframe*  m_keyframes;
+    const MediaIndexFrame*     m_frames;
+};
+
+
+// Collects the index while a file is decoded from start to end
+class MediaIndexBuilder : NoCopy
+{
+public:
+    MediaIndexBuilder();
+
+    void Add(const libav::AVFrame& frame, double sceneScore);
+    void Invalidate() { m_valid = false; } // frames were skipped (seek), the tables would have holes
+
+    bool IsValid() const { return m_valid; }
+    size_t GetFrameCount() const { return m_frames.size(); }
+
+    bool Save(const char* mediaFileName, uint64_t duration) const;
+
+private:
+    std::vector<MediaIndexKeyframe>  m_keyframes;
+    std::vector<MediaIndexFrame>     m_frames;
+    double                           m_timeBase;
+    uint64_t                         m_timeOffset;
+    bool                             m_valid;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "bufferpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+// Accumulates the time spent in one stage of the pipeline
+class StageTimer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    class Scope
+    {
+    public:
+        explicit Scope(StageTimer& timer) : m_timer(timer), m_start(Clock::now()) { }
+        ~Scope() { m_timer.Add(Clock::now() - m_start); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StageTimer&        m_timer;
+        Clock::time_point  m_start;
+    };
+
+    StageTimer() : m_count(0), m_totalNs(0), m_maxNs(0), m_lastNs(0) { }
+
+    void Add(Clock::duration duration)
+    {
+        const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        ++m_count;
+        m_totalNs += ns;
+        m_lastNs = ns;
+
+        uint64_t max = m_maxNs.load();
+        while (ns > max && ! m_maxNs.compare_exchange_weak(max, ns)) { }
+    }
+
+    void Reset()
+    {
+        m_count = 0;
+        m_totalNs = 0;
+        m_maxNs = 0;
+        m_lastNs = 0;
+    }
+
+    uint64_t GetCount() const { return m_count; }
+    double GetTotalMs() const { return m_totalNs / 1000000.0; }
+    double GetMaxMs() const { return m_maxNs / 1000000.0; }
+    double GetLastMs() const { return m_lastNs / 1000000.0; }
+    double GetAverageMs() const { return m_count ? GetTotalMs() / m_count : 0.0; }
+
+private:
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_totalNs;
+    std::atomic<uint64_t> m_maxNs;
+    std::atomic<uint64_t> m_lastNs;
+};
+
+
+// Process wide counters of the decode -> analysis -> display pipeline
+struct PipelineStats
+{
+    StageTimer upload;           // GUI thread blocked in texture uploads
+    StageTimer open;             // avformat_open_input, stream probing and decoder setup
+    StageTimer timeToFirstFrame; // from the open request until the first frame is handed to the widgets
+    StageTimer demuxStall;       // demuxer thread blocked on a full packet queue
+    StageTimer decodeStarved;    // decoder waiting for the demuxer
+    std::atomic<uint64_t> decodedFrames{0};  // every video frame out of the decoder, shown or not
+    StageTimer liveLag;          // how far a shown live frame trailed the quickest one
+    std::atomic<uint64_t> droppedFrames{0};  // live frames never shown to bound the latency
+    std::atomic<uint64_t> droppedPackets{0}; // live packets skipped to catch up with the feed
+
+    static PipelineStats& Instance()
+    {
+        static PipelineStats stats;
+        return stats;
+    }
+
+    std::string Report() const
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2);
+        out << "upload " << upload.GetAverageMs() << " ms (max " << upload.GetMaxMs() << " ms)";
+        if (timeToFirstFrame.GetCount())
+            out << ", open " << open.GetLastMs() << " ms, first frame " << timeToFirstFrame.GetLastMs() << " ms";
+        if (decodeStarved.GetCount())
+            out << ", starved " << decodeStarved.GetTotalMs() << " ms, demux stalled " << demuxStall.GetTotalMs() << " ms";
+        if (liveLag.GetCount())
+            out << ", lag " << liveLag.GetLastMs() << " ms, dropped " << droppedFrames << " frames / " << droppedPackets << " packets";
+
+        const libav::AVBufferPool::Stats pool = libav::AVBufferPool::Instance().GetStats();
+        out << ", buffers " << (pool.bytesInUse >> 20) << "+" << (pool.bytesRetained >> 20) << " MiB ("
+            << pool.systemAllocations << " allocated, " << pool.reused << " reused)";
+        return out.str();
+    }
+
+private:
+    PipelineStats() = default;
+    PipelineStats(const PipelineStats&) = delete;
+    PipelineStats& operator=(const PipelineStats&) = delete;
+};
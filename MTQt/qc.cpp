@@ -0,0 +1,201 @@
+#include "qc.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+QcAnalyzer::QcAnalyzer(unsigned blackLevel, double blackRatio, double freezeMotion)
+    : m_blackLevel(std::min(blackLevel, 255u))
+    , m_blackRatio(blackRatio)
+    , m_freezeMotion(freezeMotion)
+    , m_width(0)
+    , m_height(0)
+    , m_hasPrevious(false)
+{
+    Reset();
+}
+
+void QcAnalyzer::Reset()
+{
+    memset(&m_last, 0, sizeof(m_last));
+    m_hasPrevious = false;
+    m_frames = 0;
+    m_illegalFrames = 0;
+    m_blackFrames = 0;
+    m_frozenFrames = 0;
+    m_minLuma = 255;
+    m_maxLuma = 0;
+    m_lumaSum = 0;
+    m_lumaPixels = 0;
+}
+
+bool QcAnalyzer::IsSupported(::PixelFormat format)
+{
+    switch (format) {
+        case PIX_FMT_YUV420P:
+        case PIX_FMT_YUVJ420P:
+        case PIX_FMT_YUV422P:
+        case PIX_FMT_YUVJ422P:
+        case PIX_FMT_YUV444P:
+        case PIX_FMT_YUVJ444P:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void QcAnalyzer::ScanRow(const uint8_t* row, uint8_t* previous, size_t width,
+                         uint8_t low, uint8_t high, uint8_t dark, RowStats& stats)
+{
+    uint8_t min = 255, max = 0;
+    uint64_t sum = 0, below = 0, above = 0, darkCount = 0, sad = 0;
+    size_t x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBound = _mm_set1_epi8(char(low ? low - 1 : 0));
+    const __m128i highBound = _mm_set1_epi8(char(high < 255 ? high + 1 : 255));
+    const __m128i darkBound = _mm_set1_epi8(char(dark));
+    __m128i vmin = _mm_set1_epi8(char(255)), vmax = zero;
+    __m128i vsum = zero, vsad = zero, vbelow = zero, vabove = zero, vdark = zero;
+
+    while (x + 16 <= width) {
+        // Byte wide counters, widened before they can wrap
+        __m128i cbelow = zero, cabove = zero, cdark = zero;
+        const size_t end = std::min(width & ~size_t(15), x + 16 * 255);
+        for (; x < end; x += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            vmin = _mm_min_epu8(vmin, v);
+            vmax = _mm_max_epu8(vmax, v);
+            vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+            if (low)
+                cbelow = _mm_sub_epi8(cbelow, _mm_cmpeq_epi8(_mm_min_epu8(v, lowBound), v));
+            if (high < 255)
+                cabove = _mm_sub_epi8(cabove, _mm_cmpeq_epi8(_mm_max_epu8(v, highBound), v));
+            cdark = _mm_sub_epi8(cdark, _mm_cmpeq_epi8(_mm_min_epu8(v, darkBound), v));
+            if (previous) {
+                __m128i* p = reinterpret_cast<__m128i*>(previous + x);
+                vsad = _mm_add_epi64(vsad, _mm_sad_epu8(v, _mm_loadu_si128(p)));
+                _mm_storeu_si128(p, v);
+            }
+        }
+        vbelow = _mm_add_epi64(vbelow, _mm_sad_epu8(cbelow, zero));
+        vabove = _mm_add_epi64(vabove, _mm_sad_epu8(cabove, zero));
+        vdark = _mm_add_epi64(vdark, _mm_sad_epu8(cdark, zero));
+    }
+
+    uint8_t bytes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), vmin);
+    min = *std::min_element(bytes, bytes + 16);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), vmax);
+    max = *std::max_element(bytes, bytes + 16);
+
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vsum);
+    sum = lanes[0] + lanes[1];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vsad);
+    sad = lanes[0] + lanes[1];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vbelow);
+    below = lanes[0] + lanes[1];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vabove);
+    above = lanes[0] + lanes[1];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vdark);
+    darkCount = lanes[0] + lanes[1];
+#endif
+    for (; x < width; ++x) {
+        const uint8_t v = row[x];
+        min = std::min(min, v);
+        max = std::max(max, v);
+        sum += v;
+        below += v < low;
+        above += v > high;
+        darkCount += v <= dark;
+        if (previous) {
+            sad += v > previous[x] ? v - previous[x] : previous[x] - v;
+            previous[x] = v;
+        }
+    }
+
+    stats.min = std::min(stats.min, min);
+    stats.max = std::max(stats.max, max);
+    stats.sum += sum;
+    stats.below += below;
+    stats.above += above;
+    stats.dark += darkCount;
+    stats.sad += sad;
+}
+
+QcPlane QcAnalyzer::ScanPlane(const uint8_t* data, unsigned lineSize, unsigned width, unsigned height,
+                              uint8_t low, uint8_t high, bool luma, uint64_t& dark, uint64_t& sad)
+{
+    RowStats stats = { 255, 0, 0, 0, 0, 0, 0 };
+    for (unsigned y = 0; y < height; ++y) {
+        uint8_t* previous = luma ? m_previous.data() + size_t(y) * width : nullptr;
+        ScanRow(data + size_t(y) * lineSize, previous, width, low, high, m_blackLevel, stats);
+    }
+    dark = stats.dark;
+    sad = stats.sad;
+
+    QcPlane plane;
+    plane.min = stats.min;
+    plane.max = stats.max;
+    plane.mean = width && height ? double(stats.sum) / (double(width) * height) : 0.0;
+    plane.below = stats.below;
+    plane.above = stats.above;
+    return plane;
+}
+
+bool QcAnalyzer::Feed(const libav::AVFrame& frame)
+{
+    const ::PixelFormat format = static_cast< ::PixelFormat>(frame.GetRaw()->format);
+    if (! IsSupported(format))
+        return false;
+
+    const unsigned width = frame.GetWidth();
+    const unsigned height = frame.GetHeight();
+    unsigned chromaWidth = width, chromaHeight = height;
+    if (format == PIX_FMT_YUV420P || format == PIX_FMT_YUVJ420P) {
+        chromaWidth = (width + 1) / 2;
+        chromaHeight = (height + 1) / 2;
+    } else if (format == PIX_FMT_YUV422P || format == PIX_FMT_YUVJ422P) {
+        chromaWidth = (width + 1) / 2;
+    }
+
+    // Full range material has no illegal levels
+    const bool fullRange = format == PIX_FMT_YUVJ420P || format == PIX_FMT_YUVJ422P || format == PIX_FMT_YUVJ444P;
+    const uint8_t lumaLow = fullRange ? 0 : LUMA_MIN, lumaHigh = fullRange ? 255 : LUMA_MAX;
+    const uint8_t chromaLow = fullRange ? 0 : CHROMA_MIN, chromaHigh = fullRange ? 255 : CHROMA_MAX;
+
+    if (width != m_width || height != m_height) {
+        m_previous.resize(size_t(width) * height);
+        m_width = width;
+        m_height = height;
+        m_hasPrevious = false;
+    }
+
+    uint64_t dark = 0, sad = 0, unused = 0;
+    QcRecord& record = m_last;
+    record.timestamp = frame.GetTimestamp();
+    record.planes[0] = ScanPlane(frame.GetPlane(0), frame.GetLineSize(0), width, height, lumaLow, lumaHigh, true, dark, sad);
+    record.planes[1] = ScanPlane(frame.GetPlane(1), frame.GetLineSize(1), chromaWidth, chromaHeight, chromaLow, chromaHigh, false, unused, unused);
+    record.planes[2] = ScanPlane(frame.GetPlane(2), frame.GetLineSize(2), chromaWidth, chromaHeight, chromaLow, chromaHigh, false, unused, unused);
+
+    const double pixels = double(width) * height;
+    record.darkRatio = pixels ? dark / pixels : 0.0;
+    record.motion = m_hasPrevious && pixels ? sad / pixels : -1.0;
+    record.black = record.darkRatio >= m_blackRatio;
+    record.frozen = m_hasPrevious && record.motion <= m_freezeMotion;
+    m_hasPrevious = true;
+
+    ++m_frames;
+    m_illegalFrames += record.IsIllegal() ? 1 : 0;
+    m_blackFrames += record.black ? 1 : 0;
+    m_frozenFrames += record.frozen ? 1 : 0;
+    m_minLuma = std::min(m_minLuma, record.planes[0].min);
+    m_maxLuma = std::max(m_maxLuma, record.planes[0].max);
+    m_lumaSum += uint64_t(record.planes[0].mean * pixels + 0.5);
+    m_lumaPixels += uint64_t(pixels);
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+#include <vector>
+
+struct QcPlane
+{
+    uint8_t   min;
+    uint8_t   max;
+    double    mean;
+    uint64_t  below; // pixels under the legal range
+    uint64_t  above; // pixels over the legal range
+};
+
+
+struct QcRecord
+{
+    uint64_t  timestamp;  // milliseconds
+    QcPlane   planes[3];  // Y, U, V
+    double    darkRatio;  // share of luma at or below the black level
+    double    motion;     // mean absolute luma difference to the previous frame
+    bool      black;
+    bool      frozen;
+
+    bool IsIllegal() const
+    {
+        for (const QcPlane& plane : planes)
+            if (plane.below || plane.above)
+                return true;
+        return false;
+    }
+};
+
+
+// Delivery QC of planar 8 bit YUV: one pass over each plane collects the levels, the
+// legal range violations, the black level share and the difference to the previous frame
+class QcAnalyzer : NoCopy
+{
+public:
+    static const unsigned LUMA_MIN = 16, LUMA_MAX = 235;
+    static const unsigned CHROMA_MIN = 16, CHROMA_MAX = 240;
+
+    QcAnalyzer(unsigned blackLevel = 32, double blackRatio = 0.98, double freezeMotion = 0.25);
+
+    static bool IsSupported(::PixelFormat format);
+
+    // Returns false for formats the analyzer cannot read
+    bool Feed(const libav::AVFrame& frame);
+    void Reset();
+
+    const QcRecord& GetLast() const { return m_last; }
+    uint64_t GetFrameCount() const { return m_frames; }
+    uint64_t GetIllegalFrames() const { return m_illegalFrames; }
+    uint64_t GetBlackFrames() const { return m_blackFrames; }
+    uint64_t GetFrozenFrames() const { return m_frozenFrames; }
+    // Luma levels over every frame fed
+    unsigned GetMinLuma() const { return m_frames ? m_minLuma : 0; }
+    unsigned GetMaxLuma() const { return m_maxLuma; }
+    double GetMeanLuma() const { return m_lumaPixels ? double(m_lumaSum) / m_lumaPixels : 0.0; }
+
+    struct RowStats {
+        uint8_t   min;
+        uint8_t   max;
+        uint64_t  sum;
+        uint64_t  below;
+        uint64_t  above;
+        uint64_t  dark;
+        uint64_t  sad;
+    };
+
+    // Raw kernel. `previous`, if given, is compared against and then overwritten with `row`;
+    // a `low` of 0 or a `high` of 255 disables the respective range check.
+    static void ScanRow(const uint8_t* row, uint8_t* previous, size_t width,
+                        uint8_t low, uint8_t high, uint8_t dark, RowStats& stats);
+
+private:
+    QcPlane ScanPlane(const uint8_t* data, unsigned lineSize, unsigned width, unsigned height,
+                      uint8_t low, uint8_t high, bool luma, uint64_t& dark, uint64_t& sad);
+
+private:
+    const uint8_t  m_blackLevel;
+    const double   m_blackRatio;
+    const double   m_freezeMotion;
+
+    std::vector<uint8_t>  m_previous; // luma of the previous frame
+    unsigned              m_width;
+    unsigned              m_height;
+    bool                  m_hasPrevious;
+
+    QcRecord  m_last;
+    uint64_t  m_frames;
+    uint64_t  m_illegalFrames;
+    uint64_t  m_blackFrames;
+    uint64_t  m_frozenFrames;
+    uint8_t   m_minLuma;
+    uint8_t   m_maxLuma;
+    uint64_t  m_lumaSum;
+    uint64_t  m_lumaPixels;
+};
@@ -0,0 +1,157 @@
+#include "quality.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const double kC1 = (0.01 * 255) * (0.01 * 255);
+static const double kC2 = (0.03 * 255) * (0.03 * 255);
+
+struct BlockSums
+{
+    uint32_t a, b, aa, bb, ab;
+};
+
+// Sums over one SSIM_BLOCK x SSIM_BLOCK block
+static BlockSums SumBlock(const uint8_t* a, unsigned strideA, const uint8_t* b, unsigned strideB)
+{
+    BlockSums sums = { 0, 0, 0, 0, 0 };
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sa = zero, sb = zero, saa = zero, sbb = zero, sab = zero;
+    for (unsigned y = 0; y < QualityMeter::SSIM_BLOCK; ++y, a += strideA, b += strideB) {
+        const __m128i va8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a));
+        const __m128i vb8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b));
+        sa = _mm_add_epi32(sa, _mm_sad_epu8(va8, zero));
+        sb = _mm_add_epi32(sb, _mm_sad_epu8(vb8, zero));
+
+        const __m128i va = _mm_unpacklo_epi8(va8, zero);
+        const __m128i vb = _mm_unpacklo_epi8(vb8, zero);
+        saa = _mm_add_epi32(saa, _mm_madd_epi16(va, va));
+        sbb = _mm_add_epi32(sbb, _mm_madd_epi16(vb, vb));
+        sab = _mm_add_epi32(sab, _mm_madd_epi16(va, vb));
+    }
+    uint32_t lanes[4];
+    sums.a = _mm_cvtsi128_si32(sa);
+    sums.b = _mm_cvtsi128_si32(sb);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), saa);
+    sums.aa = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sbb);
+    sums.bb = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sab);
+    sums.ab = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    for (unsigned y = 0; y < QualityMeter::SSIM_BLOCK; ++y, a += strideA, b += strideB) {
+        for (unsigned x = 0; x < QualityMeter::SSIM_BLOCK; ++x) {
+            sums.a += a[x];
+            sums.b += b[x];
+            sums.aa += a[x] * a[x];
+            sums.bb += b[x] * b[x];
+            sums.ab += a[x] * b[x];
+        }
+    }
+#endif
+    return sums;
+}
+
+uint64_t QualityMeter::SumOfSquaredDifferences(const uint8_t* a, const uint8_t* b, size_t size)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    // 16 bit differences squared and pair-summed by madd, flushed to 64 bit before they can overflow
+    while (i + 16 <= size) {
+        __m128i acc = zero;
+        const size_t end = std::min(size & ~size_t(15), i + 16 * 4096);
+        for (; i < end; i += 16) {
+            const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        sum += uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    for (; i < size; ++i) {
+        const int d = int(a[i]) - int(b[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+void QualityMeter::AbsoluteDifference(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t size, unsigned gain)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (gain == 4) {
+        for (; i + 16 <= size; i += 16) {
+            const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            d = _mm_adds_epu8(d, d);
+            d = _mm_adds_epu8(d, d);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), d);
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        const unsigned d = (a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]) * gain;
+        out[i] = d > 255 ? 255 : d;
+    }
+}
+
+double QualityMeter::Psnr(double mse)
+{
+    if (mse <= 0.0)
+        return MAX_PSNR;
+    return std::min(double(MAX_PSNR), 10.0 * std::log10(255.0 * 255.0 / mse));
+}
+
+double QualityMeter::Ssim(const libav::AVFrame& reference, const libav::AVFrame& distorted)
+{
+    const unsigned n = SSIM_BLOCK * SSIM_BLOCK;
+    const unsigned columns = reference.GetWidth() / SSIM_BLOCK;
+    const unsigned rows = reference.GetHeight() / SSIM_BLOCK;
+    if (! columns || ! rows)
+        return 1.0;
+
+    double total = 0.0;
+    for (unsigned by = 0; by < rows; ++by) {
+        const uint8_t* a = reference.GetPlane(0) + size_t(by) * SSIM_BLOCK * reference.GetLineSize(0);
+        const uint8_t* b = distorted.GetPlane(0) + size_t(by) * SSIM_BLOCK * distorted.GetLineSize(0);
+        for (unsigned bx = 0; bx < columns; ++bx) {
+            const BlockSums s = SumBlock(a + bx * SSIM_BLOCK, reference.GetLineSize(0), b + bx * SSIM_BLOCK, distorted.GetLineSize(0));
+            const double muA = double(s.a) / n;
+            const double muB = double(s.b) / n;
+            const double varA = double(s.aa) / n - muA * muA;
+            const double varB = double(s.bb) / n - muB * muB;
+            const double cov = double(s.ab) / n - muA * muB;
+            total += ((2 * muA * muB + kC1) * (2 * cov + kC2)) / ((muA * muA + muB * muB + kC1) * (varA + varB + kC2));
+        }
+    }
+    return total / (double(columns) * rows);
+}
+
+FrameQuality QualityMeter::Measure(const libav::AVFrame& reference, const libav::AVFrame& distorted)
+{
+    const unsigned width = reference.GetWidth();
+    const unsigned height = reference.GetHeight();
+    uint64_t sse = 0;
+    for (unsigned y = 0; y < height; ++y)
+        sse += SumOfSquaredDifferences(reference.GetPlane(0) + size_t(y) * reference.GetLineSize(0),
+                                       distorted.GetPlane(0) + size_t(y) * distorted.GetLineSize(0), width);
+
+    FrameQuality quality;
+    quality.timestamp = reference.GetTimestamp();
+    quality.mse = width && height ? double(sse) / (double(width) * height) : 0.0;
+    quality.psnr = Psnr(quality.mse);
+    quality.ssim = Ssim(reference, distorted);
+    return quality;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+
+struct FrameQuality
+{
+    uint64_t  timestamp; // milliseconds, of the reference frame
+    double    mse;       // luma
+    double    psnr;      // dB, capped for identical frames
+    double    ssim;      // luma, mean over 8x8 blocks
+};
+
+
+// Full reference luma metrics of a distorted frame against its reference
+class QualityMeter
+{
+public:
+    static const unsigned SSIM_BLOCK = 8;
+    static constexpr double MAX_PSNR = 100.0;
+
+    // Both frames must have the same dimensions
+    static FrameQuality Measure(const libav::AVFrame& reference, const libav::AVFrame& distorted);
+
+    static double Psnr(double mse);
+    static double Ssim(const libav::AVFrame& reference, const libav::AVFrame& distorted);
+
+    // Raw kernels
+    static uint64_t SumOfSquaredDifferences(const uint8_t* a, const uint8_t* b, size_t size);
+    // |a - b| * gain with saturation, for a difference view
+    static void AbsoluteDifference(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t size, unsigned gain = 4);
+};
@@ -0,0 +1,202 @@
+#include "rawvideoreader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kY4mMagic[] = "YUV4MPEG2 ";
+static const char kY4mFrame[] = "FRAME";
+
+RawVideoReader::RawVideoReader(void* mapping, size_t size, unsigned width, unsigned height, ::PixelFormat format, double frameRate)
+    : m_mapping(mapping)
+    , m_size(size)
+    , m_width(width)
+    , m_height(height)
+    , m_format(format)
+    , m_frameRate(frameRate)
+    , m_chromaWidth(0)
+    , m_chromaHeight(0)
+    , m_planeCount(0)
+    , m_frameSize(0)
+    , m_frameCount(0)
+{
+}
+
+RawVideoReader::~RawVideoReader()
+{
+    ::munmap(m_mapping, m_size);
+}
+
+bool RawVideoReader::IsY4m(const char* fileName)
+{
+    const size_t length = strlen(fileName);
+    return length > 4 && strcasecmp(fileName + length - 4, ".y4m") == 0;
+}
+
+std::unique_ptr<RawVideoReader> RawVideoReader::Map(const char* fileName, unsigned width, unsigned height,
+                                                    ::PixelFormat format, double frameRate)
+{
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+    return std::unique_ptr<RawVideoReader>(new RawVideoReader(mapping, st.st_size, width, height, format, frameRate));
+}
+
+std::unique_ptr<RawVideoReader> RawVideoReader::OpenRaw(const char* fileName, unsigned width, unsigned height,
+                                                        ::PixelFormat format, double frameRate)
+{
+    std::unique_ptr<RawVideoReader> reader = Map(fileName, width, height, format, frameRate);
+    if (! reader || ! reader->Layout() || frameRate <= 0.0)
+        return nullptr;
+    reader->m_frameCount = reader->m_size / reader->m_frameSize;
+    return reader->m_frameCount ? std::move(reader) : nullptr;
+}
+
+std::unique_ptr<RawVideoReader> RawVideoReader::OpenY4m(const char* fileName)
+{
+    std::unique_ptr<RawVideoReader> reader = Map(fileName, 0, 0, PIX_FMT_YUV420P, 25.0);
+    if (! reader)
+        return nullptr;
+
+    // Stream header: "YUV4MPEG2 W<width> H<height> F<num>:<den> C<colorspace> ...\n"
+    const char* data = static_cast<const char*>(reader->m_mapping);
+    const char* end = static_cast<const char*>(memchr(data, '\n', std::min<size_t>(reader->m_size, 4096)));
+    if (! end || reader->m_size < sizeof(kY4mMagic) - 1 || memcmp(data, kY4mMagic, sizeof(kY4mMagic) - 1) != 0)
+        return nullptr;
+
+    const std::string header(data, end);
+    for (size_t pos = header.find(' '); pos != std::string::npos; pos = header.find(' ', pos + 1)) {
+        const char tag = pos + 1 < header.size() ? header[pos + 1] : 0;
+        const char* value = header.c_str() + pos + 2;
+        if (tag == 'W') {
+            reader->m_width = atoi(value);
+        } else if (tag == 'H') {
+            reader->m_height = atoi(value);
+        } else if (tag == 'F') {
+            const double numerator = atof(value);
+            const char* colon = strchr(value, ':');
+            const double denominator = colon ? atof(colon + 1) : 1.0;
+            if (numerator > 0.0 && denominator > 0.0)
+                reader->m_frameRate = numerator / denominator;
+        } else if (tag == 'C') {
+            // Exact names only: "420p10", "422p16" and the like are high bit depth
+            const std::string colorspace = header.substr(pos + 2, header.find(' ', pos + 1) - pos - 2);
+            if (colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2")
+                reader->m_format = PIX_FMT_YUV420P;
+            else if (colorspace == "422")
+                reader->m_format = PIX_FMT_YUV422P;
+            else if (colorspace == "444")
+                reader->m_format = PIX_FMT_YUV444P;
+            else if (colorspace == "mono")
+                reader->m_format = PIX_FMT_GRAY8;
+            else
+                throw libav::AVError(("unsupported y4m colorspace C" + colorspace + " (8 bit 420, 422, 444 and mono only)").c_str());
+        }
+    }
+
+    if (! reader->Layout() || ! reader->IndexY4m(end + 1 - data))
+        return nullptr;
+    return reader;
+}
+
+bool RawVideoReader::Layout()
+{
+    if (! m_width || ! m_height)
+        return false;
+
+    m_chromaWidth = m_width;
+    m_chromaHeight = m_height;
+    m_planeCount = 3;
+    switch (m_format) {
+        case PIX_FMT_YUV420P:
+        case PIX_FMT_YUVJ420P:
+            m_chromaWidth = (m_width + 1) / 2;
+            m_chromaHeight = (m_height + 1) / 2;
+            break;
+        case PIX_FMT_YUV422P:
+        case PIX_FMT_YUVJ422P:
+            m_chromaWidth = (m_width + 1) / 2;
+            break;
+        case PIX_FMT_YUV444P:
+        case PIX_FMT_YUVJ444P:
+            break;
+        case PIX_FMT_GRAY8:
+            m_chromaWidth = m_chromaHeight = 0;
+            m_planeCount = 1;
+            break;
+        default:
+            return false;
+    }
+    m_frameSize = size_t(m_width) * m_height + 2 * size_t(m_chromaWidth) * m_chromaHeight;
+    return true;
+}
+
+// Every picture is preceded by "FRAME[ params]\n"; parameters are optional, so the
+// headers differ in length and the offsets are collected once up front
+bool RawVideoReader::IndexY4m(size_t dataOffset)
+{
+    const char* data = static_cast<const char*>(m_mapping);
+    size_t pos = dataOffset;
+    while (pos + sizeof(kY4mFrame) - 1 <= m_size && memcmp(data + pos, kY4mFrame, sizeof(kY4mFrame) - 1) == 0) {
+        const char* newline = static_cast<const char*>(memchr(data + pos, '\n', std::min<size_t>(m_size - pos, 1024)));
+        if (! newline)
+            break;
+        const size_t picture = newline + 1 - data;
+        if (picture + m_frameSize > m_size)
+            break; // truncated last frame
+        m_offsets.push_back(picture);
+        pos = picture + m_frameSize;
+    }
+    return ! m_offsets.empty();
+}
+
+bool RawVideoReader::GetFrame(size_t index, libav::AVFrame& frame) const
+{
+    if (index >= GetFrameCount())
+        return false;
+
+    uint8_t* picture = static_cast<uint8_t*>(m_mapping) + (m_offsets.empty() ? index * m_frameSize : m_offsets[index]);
+    ::AVFrame& raw = *frame.GetRaw();
+    memset(raw.data, 0, sizeof(raw.data));
+    memset(raw.linesize, 0, sizeof(raw.linesize));
+    raw.data[0] = picture;
+    raw.linesize[0] = m_width;
+    if (m_planeCount == 3) {
+        raw.data[1] = picture + size_t(m_width) * m_height;
+        raw.data[2] = raw.data[1] + size_t(m_chromaWidth) * m_chromaHeight;
+        raw.linesize[1] = raw.linesize[2] = m_chromaWidth;
+    }
+    raw.width = m_width;
+    raw.height = m_height;
+    raw.format = m_format;
+    raw.key_frame = 1;
+
+    frame.SetTimeBase(1.0 / m_frameRate);
+    frame.SetTimeOffset(0);
+    frame.SetSourceTimestamp(index);
+    return true;
+}
+
+size_t RawVideoReader::FindFrame(uint64_t timestamp) const
+{
+    const size_t index = size_t(timestamp * m_frameRate / 1000.0 + 0.5);
+    return std::min(index, GetFrameCount() ? GetFrameCount() - 1 : 0);
+}
+
+void RawVideoReader::Advise(bool sequential) const
+{
+    ::madvise(m_mapping, m_size, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Uncompressed video (.y4m, or headerless planar YUV) read straight from a read-only
+// mapping. Frames are views: their plane pointers point into the mapping, nothing is
+// copied and any frame can be reached in constant time.
+class RawVideoReader : NoCopy
+{
+public:
+    ~RawVideoReader();
+
+    static bool IsY4m(const char* fileName);
+
+    // nullptr if the file cannot be mapped or does not hold whole frames
+    static std::unique_ptr<RawVideoReader> OpenY4m(const char* fileName);
+    static std::unique_ptr<RawVideoReader> OpenRaw(const char* fileName, unsigned width, unsigned height,
+                                                   ::PixelFormat format, double frameRate = 25.0);
+
+    size_t GetFrameCount() const { return m_offsets.empty() ? m_frameCount : m_offsets.size(); }
+    unsigned GetWidth() const { return m_width; }
+    unsigned GetHeight() const { return m_height; }
+    ::PixelFormat GetFormat() const { return m_format; }
+    double GetFrameRate() const { return m_frameRate; }
+    uint64_t GetDuration() const { return uint64_t(GetFrameCount() * 1000000.0 / m_frameRate); } // microseconds
+
+    // Points `frame` at picture `index`; the view is valid as long as the reader
+    bool GetFrame(size_t index, libav::AVFrame& frame) const;
+    size_t FindFrame(uint64_t timestamp) const; // milliseconds
+
+    // Hands every frame to `callback` in order, like AVStream::Decode
+    template< typename TCallback >
+    bool Decode(TCallback& callback)
+    {
+        Advise(true);
+        libav::AVFrame frame;
+        for (size_t i = 0; i < GetFrameCount() && ! callback.stopped; ++i) {
+            GetFrame(i, frame);
+            if (! callback(frame, int(i + 1)))
+                break;
+        }
+        Advise(false);
+        return true;
+    }
+
+private:
+    RawVideoReader(void* mapping, size_t size, unsigned width, unsigned height, ::PixelFormat format, double frameRate);
+
+    static std::unique_ptr<RawVideoReader> Map(const char* fileName, unsigned width, unsigned height,
+                                               ::PixelFormat format, double frameRate);
+    bool Layout();
+    bool IndexY4m(size_t dataOffset);
+    void Advise(bool sequential) const;
+
+private:
+    void* const          m_mapping;
+    const size_t         m_size;
+    unsigned             m_width;
+    unsigned             m_height;
+    ::PixelFormat        m_format;
+    double               m_frameRate;
+
+    unsigned             m_chromaWidth;
+    unsigned             m_chromaHeight;
+    unsigned             m_planeCount;
+    size_t               m_frameSize;
+    size_t               m_frameCount;  // raw files
+    std::vector<size_t>  m_offsets;     // y4m files, byte offset of every picture
+};
@@ -0,0 +1,204 @@
+#include "scenedetector.h"
+
+#include <cmath>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const size_t kScoreWindow = 12;   // frames the adaptive cut threshold looks back
+static const size_t kFadeWindow = 6;     // frames of monotonic luma that make a fade
+static const double kBlackLuma = 24.0;
+static const double kMinCutSad = 10.0;   // mean absolute luma difference per pixel
+static const size_t kReservedCuts = 256; // the list only reallocates on long, busy material
+
+SceneDetector::SceneDetector(unsigned rowStep, double cutThreshold)
+    : m_rowStep(std::max(rowStep, 1u))
+    , m_cutThreshold(cutThreshold)
+    , m_width(0)
+    , m_height(0)
+    , m_histogram(HISTOGRAM_BINS)
+    , m_previousHistogram(HISTOGRAM_BINS)
+    , m_black(false)
+    , m_hasPrevious(false)
+{
+    m_recentScores.reserve(kScoreWindow + 1);
+    m_recentLuma.reserve(kFadeWindow + 1);
+    m_cuts.reserve(kReservedCuts);
+}
+
+void SceneDetector::Reset()
+{
+    m_hasPrevious = false;
+    m_black = false;
+    m_recentScores.clear();
+    m_recentLuma.clear();
+    m_cuts.clear();
+}
+
+uint64_t SceneDetector::SumOfAbsDifferences(const uint8_t* a, const uint8_t* b, size_t size)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < size; ++i)
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    return sum;
+}
+
+uint64_t SceneDetector::SumOfBytes(const uint8_t* data, size_t size)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // The absolute difference to zero is the value itself
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 16 <= size; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), zero));
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < size; ++i)
+        sum += data[i];
+    return sum;
+}
+
+float SceneDetector::HistogramDistance(const float* a, const float* b, size_t bins)
+{
+    float sum = 0.0f;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= bins; i += 4)
+        acc = _mm_add_ps(acc, _mm_and_ps(absMask, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < bins; ++i)
+        sum += std::fabs(a[i] - b[i]);
+    return sum * 0.5f; // both histograms are normalized, so the result is within [0, 1]
+}
+
+// Halves the width by averaging pixel pairs and keeps every m_rowStep-th row
+void SceneDetector::Downsample(const libav::AVFrame& frame)
+{
+    m_width = frame.GetWidth() / 2;
+    m_height = (frame.GetHeight() + m_rowStep - 1) / m_rowStep;
+    m_current.resize(size_t(m_width) * m_height);
+
+    uint32_t counts[4][HISTOGRAM_BINS] = {};
+    for (unsigned row = 0; row < m_height; ++row) {
+        const uint8_t* src = frame.GetPlane(0) + size_t(row) * m_rowStep * frame.GetLineSize(0);
+        uint8_t* dst = m_current.data() + size_t(row) * m_width;
+
+        unsigned x = 0;
+#if defined(__SSE2__)
+        const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+        for (; x + 16 <= m_width; x += 16) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * x));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * x + 16));
+            const __m128i avgA = _mm_avg_epu16(_mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8));
+            const __m128i avgB = _mm_avg_epu16(_mm_and_si128(b, lowBytes), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(avgA, avgB));
+        }
+#endif
+        for (; x < m_width; ++x)
+            dst[x] = static_cast<uint8_t>((src[2 * x] + src[2 * x + 1] + 1) >> 1);
+
+        // Four interleaved tables break the store-to-load dependency on repeated values
+        x = 0;
+        for (; x + 4 <= m_width; x += 4) {
+            ++counts[0][dst[x] >> 2];
+            ++counts[1][dst[x + 1] >> 2];
+            ++counts[2][dst[x + 2] >> 2];
+            ++counts[3][dst[x + 3] >> 2];
+        }
+        for (; x < m_width; ++x)
+            ++counts[0][dst[x] >> 2];
+    }
+
+    const float scale = m_current.empty() ? 0.0f : 1.0f / m_current.size();
+    for (unsigned bin = 0; bin < HISTOGRAM_BINS; ++bin)
+        m_histogram[bin] = (counts[0][bin] + counts[1][bin] + counts[2][bin] + counts[3][bin]) * scale;
+}
+
+void SceneDetector::Feed(const libav::AVFrame& frame)
+{
+    if (frame.GetWidth() < 2 || ! frame.GetPlane(0))
+        return;
+
+    const unsigned previousWidth = m_width, previousHeight = m_height;
+    Downsample(frame);
+    if (m_width != previousWidth || m_height != previousHeight)
+        m_hasPrevious = false; // resolution change
+
+    double meanLuma = 0.0;
+    for (unsigned bin = 0; bin < HISTOGRAM_BINS; ++bin)
+        meanLuma += m_histogram[bin] * (bin * 4 + 2);
+
+    bool cut = false;
+    if (m_hasPrevious) {
+        const double score = HistogramDistance(m_histogram.data(), m_previousHistogram.data(), HISTOGRAM_BINS);
+        const double sad = double(SumOfAbsDifferences(m_current.data(), m_previous.data(), m_current.size())) / m_current.size();
+
+        const double average = m_recentScores.empty()
+            ? 0.0
+            : std::accumulate(m_recentScores.begin(), m_recentScores.end(), 0.0) / m_recentScores.size();
+
+        // A cut must stand out both absolutely and against the recent motion level
+        cut = score > m_cutThreshold && score > 3.0 * std::max(average, 0.02) && sad > kMinCutSad;
+        if (cut) {
+            m_cuts.push_back(SceneCut{ frame.GetTimestamp(), SceneCut::CUT, score });
+            m_recentScores.clear();
+        } else {
+            m_recentScores.push_back(score);
+            if (m_recentScores.size() > kScoreWindow)
+                m_recentScores.erase(m_recentScores.begin());
+        }
+    }
+
+    DetectFade(frame.GetTimestamp(), meanLuma, cut);
+
+    m_previous.swap(m_current);
+    m_previousHistogram.swap(m_histogram);
+    m_hasPrevious = true;
+}
+
+void SceneDetector::DetectFade(uint64_t timestamp, double meanLuma, bool cut)
+{
+    m_recentLuma.push_back(meanLuma);
+    if (m_recentLuma.size() > kFadeWindow)
+        m_recentLuma.erase(m_recentLuma.begin());
+
+    if (! m_black && meanLuma < kBlackLuma) {
+        m_black = true;
+        if (cut || m_recentLuma.size() < kFadeWindow)
+            return;
+        // Fade out: luma went down steadily into black
+        bool falling = true;
+        for (size_t i = 1; i < m_recentLuma.size(); ++i)
+            falling &= m_recentLuma[i] <= m_recentLuma[i - 1];
+        if (falling && m_recentLuma.front() - meanLuma > kBlackLuma)
+            m_cuts.push_back(SceneCut{ timestamp, SceneCut::FADE_OUT, (m_recentLuma.front() - meanLuma) / 255.0 });
+    } else if (m_black && meanLuma > kBlackLuma + 4.0) {
+        // Hysteresis keeps noise around the threshold from producing events
+        m_black = false;
+        if (! cut)
+            m_cuts.push_back(SceneCut{ timestamp, SceneCut::FADE_IN, meanLuma / 255.0 });
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "libav.h"
+
+#include <cstdint>
+#include <vector>
+
+struct SceneCut
+{
+    enum Type {
+        CUT,
+        FADE_IN,
+        FADE_OUT
+    };
+
+    uint64_t  timestamp; // milliseconds
+    Type      type;
+    double    score;
+};
+
+
+// Finds shot boundaries by comparing the (downsampled) luma of consecutive frames
+class SceneDetector : NoCopy
+{
+public:
+    static const unsigned HISTOGRAM_BINS = 64;
+
+    SceneDetector(unsigned rowStep = 2, double cutThreshold = 0.3);
+
+    void Feed(const libav::AVFrame& frame);
+    void Reset();
+
+    const std::vector<SceneCut>& GetCuts() const { return m_cuts; }
+
+    // Raw kernels, exposed for reuse by other analysis stages
+    static uint64_t SumOfAbsDifferences(const uint8_t* a, const uint8_t* b, size_t size);
+    static uint64_t SumOfBytes(const uint8_t* data, size_t size);
+    static float HistogramDistance(const float* a, const float* b, size_t bins);
+
+private:
+    void Downsample(const libav::AVFrame& frame);
+    void DetectFade(uint64_t timestamp, double meanLuma, bool cut);
+
+private:
+    const unsigned  m_rowStep;
+    const double    m_cutThreshold;
+
+    unsigned              m_width;
+    unsigned              m_height;
+    std::vector<uint8_t>  m_current;
+    std::vector<uint8_t>  m_previous;
+    std::vector<float>    m_histogram;
+    std::vector<float>    m_previousHistogram;
+    std::vector<double>   m_recentScores; // short sliding windows, reserved up front so
+    std::vector<double>   m_recentLuma;   // that steady-state analysis does not allocate
+    bool                  m_black;
+    bool                  m_hasPrevious;
+
+    std::vector<SceneCut> m_cuts;
+};
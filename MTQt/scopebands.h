@@ -0,0 +1,74 @@
+#pragma once
+
+#include "libav.h"
+#include "scoperenderer.h"
+
+#include <chrono>
+#include <cstdint>
+
+// Waveform and vectorscope counted from the bands the decoder hands out (AVOpenOptions::
+// videoBands) while their rows are still in cache. Both scopes are composited the moment
+// the last band of a picture lands, before the decoder even returns the frame, so there
+// is no second pass over the picture. Feed() runs on the decoding thread. The vectorscope
+// is square, as high as the waveform.
+class ScopeBands : NoCopy
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit ScopeBands(unsigned width = 512, unsigned height = 256)
+        : m_waveform(false, width, height, 1)
+        , m_vectorscope(true, height, height, 1)
+        , m_counting(nullptr)
+        , m_nextRow(0)
+        , m_complete(nullptr)
+        , m_completed(0)
+    { }
+
+    void Feed(const libav::AVBand& band)
+    {
+        AllocTracker::Scope stage(AllocTracker::STAGE_ANALYSIS);
+        if (band.y == 0) {
+            m_counting = nullptr;
+            if (m_waveform.BeginFrame(band.frameWidth, band.frameHeight, band.format)
+                && m_vectorscope.BeginFrame(band.frameWidth, band.frameHeight, band.format)) {
+                m_counting = band.picture->data[0];
+                m_nextRow = 0;
+            }
+        }
+        // A band out of order or of another picture leaves this one to the full frame path
+        if (! m_counting || band.picture->data[0] != m_counting || band.y != m_nextRow) {
+            m_counting = nullptr;
+            return;
+        }
+
+        m_waveform.AddBand(band.planes, band.lineSizes, band.y, band.height);
+        m_vectorscope.AddBand(band.planes, band.lineSizes, band.y, band.height);
+        m_nextRow = band.y + band.height;
+        if (m_nextRow >= band.frameHeight) {
+            m_waveform.FinishFrame();
+            m_vectorscope.FinishFrame();
+            m_complete = m_counting;
+            m_completedAt = Clock::now();
+            m_counting = nullptr;
+            ++m_completed;
+        }
+    }
+
+    // The scopes of `frame` if all of its bands were counted, otherwise nullptr
+    const libav::AVTempFrame* GetWaveform(const libav::AVFrame& frame) const { return IsComplete(frame) ? m_waveform.GetPicture() : nullptr; }
+    const libav::AVTempFrame* GetVectorscope(const libav::AVFrame& frame) const { return IsComplete(frame) ? m_vectorscope.GetPicture() : nullptr; }
+
+    bool IsComplete(const libav::AVFrame& frame) const { return m_complete && frame.GetPlane(0) == m_complete; }
+    Clock::time_point GetCompletedAt() const { return m_completedAt; } // of the last complete picture
+    uint64_t GetCompleted() const { return m_completed; }
+
+private:
+    ScopeRenderer      m_waveform;
+    ScopeRenderer      m_vectorscope;
+    const uint8_t*     m_counting;   // first luma row of the picture being counted
+    unsigned           m_nextRow;
+    const uint8_t*     m_complete;   // first luma row of the picture the scopes show
+    Clock::time_point  m_completedAt;
+    uint64_t           m_completed;
+};
@@ -0,0 +1,295 @@
+#include "scoperenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const unsigned kMaxHits = 4096; // the tone map saturates well before this
+
+ScopeRenderer::ScopeRenderer(bool vectorscope, unsigned width, unsigned height, unsigned threads)
+    : m_vectorscope(vectorscope)
+    , m_width(std::max(width, 16u))
+    , m_height(std::max(height, 16u))
+    , m_pool(threads ? threads : std::thread::hardware_concurrency())
+    , m_toneMap(kMaxHits)
+    , m_toneSamples(0)
+    , m_sourceWidth(0)
+    , m_sourceHeight(0)
+    , m_chromaWidth(0)
+    , m_chromaHeight(0)
+    , m_chromaShift(0)
+    , m_picture(new libav::AVTempFrame(libav::AVImageFormat(m_width, m_height, PIX_FMT_RGB24)))
+{
+    // Waveform bands own disjoint columns and share one table, vectorscope bands get one each
+    m_counts.resize(m_vectorscope ? m_pool.GetThreadCount() : 1, std::vector<uint32_t>(size_t(m_width) * m_height));
+    BuildGraticule();
+}
+
+bool ScopeRenderer::IsSupported(::PixelFormat format)
+{
+    switch (format) {
+        case PIX_FMT_YUV420P:
+        case PIX_FMT_YUVJ420P:
+        case PIX_FMT_YUV422P:
+        case PIX_FMT_YUVJ422P:
+        case PIX_FMT_YUV444P:
+        case PIX_FMT_YUVJ444P:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Chroma plane size of the supported formats; `shift` is the vertical subsampling
+static void ChromaSize(::PixelFormat format, unsigned width, unsigned height, unsigned& chromaWidth, unsigned& chromaHeight, unsigned& shift)
+{
+    chromaWidth = width;
+    chromaHeight = height;
+    shift = 0;
+    if (format == PIX_FMT_YUV420P || format == PIX_FMT_YUVJ420P) {
+        chromaWidth = (width + 1) / 2;
+        chromaHeight = (height + 1) / 2;
+        shift = 1;
+    } else if (format == PIX_FMT_YUV422P || format == PIX_FMT_YUVJ422P) {
+        chromaWidth = (width + 1) / 2;
+    }
+}
+
+const libav::AVTempFrame* ScopeRenderer::Render(const libav::AVFrame& frame)
+{
+    const ::PixelFormat format = static_cast< ::PixelFormat>(frame.GetRaw()->format);
+    if (! IsSupported(format) || ! frame.GetWidth() || ! frame.GetHeight())
+        return nullptr;
+
+    MapLevels(frame.GetWidth());
+    if (m_vectorscope) {
+        unsigned chromaWidth, chromaHeight, shift;
+        ChromaSize(format, frame.GetWidth(), frame.GetHeight(), chromaWidth, chromaHeight, shift);
+        CountVectorscope(frame, chromaWidth, chromaHeight);
+        Composite(chromaWidth * chromaHeight);
+    } else {
+        CountWaveform(frame);
+        Composite(frame.GetWidth() * frame.GetHeight());
+    }
+
+    m_picture->SetTimeBase(frame.GetTimeBase());
+    m_picture->SetTimeOffset(frame.GetTimeOffset());
+    m_picture->SetSourceTimestamp(frame.GetSourceTimestamp());
+    return m_picture.get();
+}
+
+bool ScopeRenderer::BeginFrame(unsigned width, unsigned height, ::PixelFormat format)
+{
+    if (! IsSupported(format) || ! width || ! height)
+        return false;
+
+    MapLevels(width);
+    m_sourceWidth = width;
+    m_sourceHeight = height;
+    ChromaSize(format, width, height, m_chromaWidth, m_chromaHeight, m_chromaShift);
+    for (std::vector<uint32_t>& counts : m_counts)
+        std::fill(counts.begin(), counts.end(), 0u);
+    return true;
+}
+
+void ScopeRenderer::AddBand(const uint8_t* const planes[3], const int lineSizes[3], unsigned y, unsigned rows)
+{
+    uint32_t* const counts = m_counts[0].data();
+    if (! m_vectorscope) {
+        const uint32_t* columnOf = m_columnOf.data();
+        for (unsigned row = 0; row < rows; ++row) {
+            const uint8_t* luma = planes[0] + size_t(row) * lineSizes[0];
+            for (unsigned x = 0; x < m_sourceWidth; ++x)
+                ++counts[m_rowOf[luma[x]] + columnOf[x]];
+        }
+        return;
+    }
+
+    // A chroma row belongs to the band its first luma row is in; the chroma planes of the
+    // band start at the row of luma row `y`
+    const unsigned rounding = (1u << m_chromaShift) - 1;
+    const unsigned first = (y + rounding) >> m_chromaShift;
+    const unsigned last = std::min(m_chromaHeight, (y + rows + rounding) >> m_chromaShift);
+    for (unsigned row = first; row < last; ++row) {
+        const size_t offset = row - (y >> m_chromaShift);
+        const uint8_t* u = planes[1] + offset * lineSizes[1];
+        const uint8_t* v = planes[2] + offset * lineSizes[2];
+        for (unsigned x = 0; x < m_chromaWidth; ++x)
+            ++counts[m_rowOf[v[x]] + m_levelColumn[u[x]]];
+    }
+}
+
+const libav::AVTempFrame* ScopeRenderer::FinishFrame()
+{
+    Composite(m_vectorscope ? m_chromaWidth * m_chromaHeight : m_sourceWidth * m_sourceHeight);
+    return m_picture.get();
+}
+
+// Waveform: column x of the source lands in output column x * width / sourceWidth, luma 255
+// at the top. Vectorscope: U runs left to right, V bottom to top in a centred square.
+void ScopeRenderer::MapLevels(unsigned sourceWidth)
+{
+    if (! m_vectorscope) {
+        for (unsigned level = 0; level < 256; ++level)
+            m_rowOf[level] = uint32_t((m_height - 1 - level * (m_height - 1) / 255) * m_width);
+        if (m_columnOf.size() != sourceWidth) {
+            m_columnOf.resize(sourceWidth);
+            for (unsigned x = 0; x < sourceWidth; ++x)
+                m_columnOf[x] = uint32_t(uint64_t(x) * m_width / sourceWidth);
+        }
+        return;
+    }
+
+    const unsigned side = std::min(m_width, m_height);
+    const unsigned left = (m_width - side) / 2, top = (m_height - side) / 2;
+    for (unsigned level = 0; level < 256; ++level) {
+        m_levelColumn[level] = left + level * (side - 1) / 255;
+        m_rowOf[level] = uint32_t((top + side - 1 - level * (side - 1) / 255) * m_width);
+    }
+}
+
+void ScopeRenderer::CountWaveform(const libav::AVFrame& frame)
+{
+    const unsigned sourceWidth = frame.GetWidth(), sourceHeight = frame.GetHeight();
+    std::vector<uint32_t>& counts = m_counts[0];
+    const uint32_t* rowOf = m_rowOf;
+    const uint32_t* columnOf = m_columnOf.data();
+
+    const unsigned bands = std::min(m_pool.GetThreadCount() * 2, m_width);
+    m_pool.Run(bands, [&](unsigned band) {
+        const unsigned firstColumn = band * m_width / bands, lastColumn = (band + 1) * m_width / bands;
+        const unsigned first = (uint64_t(firstColumn) * sourceWidth + m_width - 1) / m_width;
+        const unsigned last = (uint64_t(lastColumn) * sourceWidth + m_width - 1) / m_width;
+
+        for (unsigned row = 0; row < m_height; ++row)
+            std::fill_n(&counts[size_t(row) * m_width + firstColumn], lastColumn - firstColumn, 0u);
+        for (unsigned y = 0; y < sourceHeight; ++y) {
+            const uint8_t* luma = frame.GetPlane(0) + size_t(y) * frame.GetLineSize(0);
+            for (unsigned x = first; x < last; ++x)
+                ++counts[rowOf[luma[x]] + columnOf[x]];
+        }
+    });
+}
+
+// Every band counts a slice of rows into its own table
+void ScopeRenderer::CountVectorscope(const libav::AVFrame& frame, unsigned chromaWidth, unsigned chromaHeight)
+{
+    const uint32_t* columnOf = m_levelColumn;
+    const uint32_t* rowOf = m_rowOf;
+
+    const unsigned bands = unsigned(m_counts.size());
+    m_pool.Run(bands, [&](unsigned band) {
+        std::vector<uint32_t>& counts = m_counts[band];
+        std::fill(counts.begin(), counts.end(), 0u);
+        const unsigned first = band * chromaHeight / bands, last = (band + 1) * chromaHeight / bands;
+        for (unsigned y = first; y < last; ++y) {
+            const uint8_t* u = frame.GetPlane(1) + size_t(y) * frame.GetLineSize(1);
+            const uint8_t* v = frame.GetPlane(2) + size_t(y) * frame.GetLineSize(2);
+            for (unsigned x = 0; x < chromaWidth; ++x)
+                ++counts[rowOf[v[x]] + columnOf[u[x]]];
+        }
+    });
+}
+
+// Sums the band tables, maps hits to green and adds the graticule, one slice of rows per task
+void ScopeRenderer::Composite(unsigned sourceSamples)
+{
+    // Intensity saturates smoothly; a cell hit four times as often as the average is near white
+    if (sourceSamples != m_toneSamples) {
+        const double average = std::max(1.0, double(sourceSamples) / (m_vectorscope ? 0.1 * m_width * m_height : m_width * 32.0));
+        for (unsigned hits = 0; hits < kMaxHits; ++hits)
+            m_toneMap[hits] = uint8_t(255.0 * (1.0 - std::exp(-2.0 * hits / average)) + 0.5);
+        m_toneMap[0] = 0;
+        m_toneSamples = sourceSamples;
+    }
+
+    uint8_t* const picture = m_picture->GetRaw()->data[0];
+    const unsigned lineSize = m_picture->GetLineSize(0);
+    const unsigned bands = std::min(m_pool.GetThreadCount() * 2, m_height);
+    m_pool.Run(bands, [&](unsigned band) {
+        const unsigned first = band * m_height / bands, last = (band + 1) * m_height / bands;
+        std::vector<uint32_t> hits(m_width);
+        for (unsigned row = first; row < last; ++row) {
+            const size_t offset = size_t(row) * m_width;
+            std::copy_n(&m_counts[0][offset], m_width, hits.begin());
+            for (size_t table = 1; table < m_counts.size(); ++table) {
+                const uint32_t* counts = &m_counts[table][offset];
+                unsigned x = 0;
+#if defined(__SSE2__)
+                for (; x + 4 <= m_width; x += 4) {
+                    const __m128i sum = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&hits[x])),
+                                                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(counts + x)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(&hits[x]), sum);
+                }
+#endif
+                for (; x < m_width; ++x)
+                    hits[x] += counts[x];
+            }
+
+            uint8_t* rgb = picture + size_t(row) * lineSize;
+            for (unsigned x = 0; x < m_width; ++x) {
+                const uint8_t level = m_toneMap[std::min(hits[x], kMaxHits - 1)];
+                rgb[3 * x + 0] = level >> 2;
+                rgb[3 * x + 1] = level;
+                rgb[3 * x + 2] = level >> 2;
+            }
+            AddSaturate(rgb, &m_graticule[offset * 3], m_width);
+        }
+    });
+}
+
+void ScopeRenderer::AddSaturate(uint8_t* dst, const uint8_t* overlay, size_t count)
+{
+    const size_t bytes = count * 3;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i sum = _mm_adds_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)),
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(overlay + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), sum);
+    }
+#endif
+    for (; i < bytes; ++i)
+        dst[i] = uint8_t(std::min(dst[i] + overlay[i], 255));
+}
+
+void ScopeRenderer::BuildGraticule()
+{
+    m_graticule.assign(size_t(m_width) * m_height * 3, 0);
+    auto plot = [this](int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+        if (x < 0 || y < 0 || x >= int(m_width) || y >= int(m_height))
+            return;
+        uint8_t* pixel = &m_graticule[(size_t(y) * m_width + x) * 3];
+        pixel[0] = r; pixel[1] = g; pixel[2] = b;
+    };
+
+    if (! m_vectorscope) {
+        // Every 10% of the legal range, the legal limits themselves in amber
+        for (unsigned step = 0; step <= 10; ++step) {
+            const unsigned level = 16 + step * (235 - 16) / 10;
+            const int y = int(m_height - 1 - level * (m_height - 1) / 255);
+            const bool limit = step == 0 || step == 10;
+            for (unsigned x = 0; x < m_width; x += limit ? 1 : 2)
+                plot(x, y, limit ? 96 : 48, limit ? 64 : 48, limit ? 0 : 48);
+        }
+        return;
+    }
+
+    // Cross through neutral grey and the circle of maximum legal saturation
+    const int side = int(std::min(m_width, m_height));
+    const int cx = int(m_width) / 2, cy = int(m_height) / 2;
+    for (int i = 0; i < side; i += 2) {
+        plot(cx - side / 2 + i, cy, 48, 48, 48);
+        plot(cx, cy - side / 2 + i, 48, 48, 48);
+    }
+    const double radius = (side - 1) * 112.0 / 255.0;
+    const int steps = int(radius * 8);
+    for (int i = 0; i < steps; ++i) {
+        const double angle = 2.0 * M_PI * i / steps;
+        plot(int(std::lround(cx + radius * std::cos(angle))), int(std::lround(cy - radius * std::sin(angle))), 64, 64, 64);
+    }
+}
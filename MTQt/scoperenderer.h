@@ -0,0 +1,64 @@
+#pragma once
+
+#include "libav.h"
+#include "workerpool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Rasterizes the waveform or the vectorscope of a frame into an RGB24 picture on the CPU,
+// for archiving scopes next to QC reports without a display. Hits are counted per output
+// pixel in parallel, tone mapped to a phosphor green and a fixed graticule is added on top.
+class ScopeRenderer : NoCopy
+{
+public:
+    ScopeRenderer(bool vectorscope, unsigned width = 512, unsigned height = 256, unsigned threads = 0);
+
+    static bool IsSupported(::PixelFormat format);
+
+    // Returns nullptr for formats the renderer cannot read; the picture is valid until the next call
+    const libav::AVTempFrame* Render(const libav::AVFrame& frame);
+
+    // The same scope counted band by band on the calling thread, e.g. while the decoder hands
+    // out the rows of a picture: BeginFrame(), AddBand() for all rows, then FinishFrame()
+    bool BeginFrame(unsigned width, unsigned height, ::PixelFormat format);
+    void AddBand(const uint8_t* const planes[3], const int lineSizes[3], unsigned y, unsigned rows); // luma rows
+    const libav::AVTempFrame* FinishFrame();
+    const libav::AVTempFrame* GetPicture() const { return m_picture.get(); } // the last one rendered
+
+    bool IsVectorscope() const { return m_vectorscope; }
+    unsigned GetWidth() const { return m_width; }
+    unsigned GetHeight() const { return m_height; }
+    unsigned GetThreadCount() const { return m_pool.GetThreadCount(); }
+
+    // Composites `count` RGB24 pixels: dst = saturate(dst + overlay)
+    static void AddSaturate(uint8_t* dst, const uint8_t* overlay, size_t count);
+
+private:
+    void MapLevels(unsigned sourceWidth);
+    void CountWaveform(const libav::AVFrame& frame);
+    void CountVectorscope(const libav::AVFrame& frame, unsigned chromaWidth, unsigned chromaHeight);
+    void Composite(unsigned sourceSamples);
+    void BuildGraticule();
+
+private:
+    const bool                           m_vectorscope;
+    const unsigned                       m_width;
+    const unsigned                       m_height;
+    WorkerPool                           m_pool;
+
+    std::vector<std::vector<uint32_t>>   m_counts;     // one per band
+    std::vector<uint8_t>                 m_graticule;  // RGB24, m_width * m_height
+    std::vector<uint8_t>                 m_toneMap;    // hits -> intensity
+    std::vector<uint32_t>                m_columnOf;   // waveform column of every source column
+    uint32_t                             m_rowOf[256]; // offset of the output row of a level
+    uint32_t                             m_levelColumn[256]; // vectorscope column of a U level
+    unsigned                             m_toneSamples;
+    unsigned                             m_sourceWidth;  // of the frame counted in bands
+    unsigned                             m_sourceHeight;
+    unsigned                             m_chromaWidth;
+    unsigned                             m_chromaHeight;
+    unsigned                             m_chromaShift;  // vertical subsampling
+    std::unique_ptr<libav::AVTempFrame>  m_picture;
+};
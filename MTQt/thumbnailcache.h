@@ -0,0 +1,165 @@
+#pragma once
+
+#include "libav.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Downscaled pictures by timestamp, for showing something right away while scrubbing.
+// Bounded by the memory the pictures take; the least recently shown ones go first.
+class ThumbnailCache : NoCopy
+{
+public:
+    typedef std::shared_ptr<const libav::AVTempFrame> Thumbnail;
+
+    explicit ThumbnailCache(size_t maxBytes = 64 << 20)
+        : m_maxBytes(maxBytes)
+        , m_bytes(0)
+    { }
+
+    void Insert(uint64_t timestamp, std::unique_ptr<libav::AVTempFrame> thumbnail) // milliseconds
+    {
+        const ::AVFrame& raw = *thumbnail->GetRaw();
+        const size_t bytes = ::avpicture_get_size(static_cast< ::PixelFormat>(raw.format), raw.width, raw.height);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Erase(timestamp);
+        m_lru.push_front(timestamp);
+        m_entries[timestamp] = Entry{ Thumbnail(std::move(thumbnail)), bytes, m_lru.begin() };
+        m_bytes += bytes;
+        Evict();
+    }
+
+    // The thumbnail closest to `timestamp`, nullptr if the cache is empty
+    Thumbnail FindNearest(uint64_t timestamp)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_entries.empty())
+            return nullptr;
+
+        auto it = m_entries.lower_bound(timestamp);
+        if (it == m_entries.end() || (it != m_entries.begin() && timestamp - std::prev(it)->first < it->first - timestamp))
+            --it;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        return it->second.thumbnail;
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_lru.clear();
+        m_bytes = 0;
+    }
+
+    size_t GetMaxBytes() const { std::lock_guard<std::mutex> lock(m_mutex); return m_maxBytes; }
+    void SetMaxBytes(size_t maxBytes) { std::lock_guard<std::mutex> lock(m_mutex); m_maxBytes = maxBytes; Evict(); }
+    size_t GetBytes() const { std::lock_guard<std::mutex> lock(m_mutex); return m_bytes; }
+    size_t GetCount() const { std::lock_guard<std::mutex> lock(m_mutex); return m_entries.size(); }
+
+private:
+    struct Entry {
+        Thumbnail                      thumbnail;
+        size_t                         bytes;
+        std::list<uint64_t>::iterator  lru;
+    };
+
+    void Erase(uint64_t timestamp)
+    {
+        auto it = m_entries.find(timestamp);
+        if (it == m_entries.end())
+            return;
+        m_bytes -= it->second.bytes;
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+
+    void Evict()
+    {
+        while (m_bytes > m_maxBytes && ! m_lru.empty())
+            Erase(m_lru.back());
+    }
+
+private:
+    mutable std::mutex           m_mutex;
+    std::map<uint64_t, Entry>    m_entries;
+    std::list<uint64_t>          m_lru;     // most recently used first
+    size_t                       m_maxBytes;
+    size_t                       m_bytes;
+};
+
+
+// Fills a cache with the keyframes of a file, on its own thread and with its own input,
+// so playback is not disturbed. Only keyframes are decoded (AVDISCARD_NONKEY).
+class ThumbnailBuilder : NoCopy
+{
+public:
+    ThumbnailBuilder(const std::string& fileName, ThumbnailCache& cache, unsigned width = 160)
+        : m_fileName(fileName)
+        , m_cache(cache)
+        , m_width(std::max(width, 16u) & ~1u)
+        , m_count(0)
+        , m_finished(false)
+        , m_quit(false)
+    {
+        m_thread = std::thread(&ThumbnailBuilder::Run, this);
+    }
+
+    ~ThumbnailBuilder()
+    {
+        m_quit = true;
+        m_thread.join();
+    }
+
+    bool IsFinished() const { return m_finished; }
+    uint64_t GetCount() const { return m_count; } // keyframes added so far
+
+private:
+    void Add(const libav::AVFrame& videoFrame)
+    {
+        if (! videoFrame.GetWidth() || ! videoFrame.GetHeight())
+            return;
+        const unsigned height = std::max(2u, unsigned(uint64_t(m_width) * videoFrame.GetHeight() / videoFrame.GetWidth()) & ~1u);
+        std::unique_ptr<libav::AVTempFrame> thumbnail(
+            new libav::AVTempFrame(libav::AVImageFormat(m_width, height, PIX_FMT_YUV420P), videoFrame));
+        thumbnail->SetTimeBase(videoFrame.GetTimeBase());
+        thumbnail->SetTimeOffset(videoFrame.GetTimeOffset());
+        thumbnail->SetSourceTimestamp(videoFrame.GetSourceTimestamp());
+        m_cache.Insert(videoFrame.GetTimestamp(), std::move(thumbnail));
+        ++m_count;
+    }
+
+    void Run()
+    {
+        try {
+            libav::AVOpenOptions options;
+            options.keyframesOnly = true;
+            options.preview = true; // downscaled anyway
+            options.videoOnly = true;
+            options.interrupt = [this]() { return m_quit.load(); }; // the destructor does not wait for a stalled read
+            libav::AVInputFile input(m_fileName.c_str(), options);
+            libav::AVStream stream(input);
+            const auto running = [this]() { return ! m_quit; };
+            while (const libav::AVFrame* frame = stream.NextVideoFrame(running))
+                Add(*frame);
+        } catch (const std::exception&) {
+            // no thumbnails, scrubbing waits for the exact frame
+        }
+        m_finished = true;
+    }
+
+private:
+    const std::string      m_fileName;
+    ThumbnailCache&        m_cache;
+    const unsigned         m_width;
+    std::atomic<uint64_t>  m_count;
+    std::atomic<bool>      m_finished;
+    std::atomic<bool>      m_quit;
+    std::thread            m_thread;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run one parallel loop at a time. Run() hands out the
+// indexes [0, count) to the workers and the calling thread and returns when all are done.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned threads = std::thread::hardware_concurrency())
+        : m_task(nullptr)
+        , m_count(0)
+        , m_next(0)
+        , m_pending(0)
+        , m_generation(0)
+        , m_quit(false)
+    {
+        // The caller works too, so one thread less
+        for (unsigned i = 1; i < std::max(threads, 1u); ++i)
+            m_threads.emplace_back(&WorkerPool::Work, this);
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_start.notify_all();
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned GetThreadCount() const { return unsigned(m_threads.size()) + 1; }
+
+    void Run(unsigned count, const std::function<void(unsigned)>& task)
+    {
+        if (count <= 1 || m_threads.empty()) {
+            for (unsigned i = 0; i < count; ++i)
+                task(i);
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_pending = count;
+        ++m_generation;
+        m_start.notify_all();
+
+        RunTasks(lock);
+        m_done.wait(lock, [this]() { return m_pending == 0; });
+        m_task = nullptr;
+    }
+
+private:
+    // Called with the lock held, returns with the lock held
+    void RunTasks(std::unique_lock<std::mutex>& lock)
+    {
+        while (m_next < m_count) {
+            const unsigned index = m_next++;
+            const std::function<void(unsigned)>& task = *m_task;
+            lock.unlock();
+            task(index);
+            lock.lock();
+            if (--m_pending == 0)
+                m_done.notify_all();
+        }
+    }
+
+    void Work()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        unsigned seen = m_generation;
+        while (true) {
+            m_start.wait(lock, [&]() { return m_quit || m_generation != seen; });
+            if (m_quit)
+                return;
+            seen = m_generation;
+            RunTasks(lock);
+        }
+    }
+
+private:
+    std::vector<std::thread>                m_threads;
+
+    std::mutex                              m_mutex;
+    std::condition_variable                 m_start;
+    std::condition_variable                 m_done;
+    const std::function<void(unsigned)>*    m_task;
+    unsigned                                m_count;
+    unsigned                                m_next;
+    unsigned                                m_pending;
+    unsigned                                m_generation;
+    bool                                    m_quit;
+};
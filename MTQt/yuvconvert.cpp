@@ -0,0 +1,392 @@
+#include "yuvconvert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define YUVCONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+typedef YuvConvert::Coefficients Coefficients;
+
+// The output format decides the pixel size; BGRA is also what RGB32 means on little endian
+static int BytesPerPixel(int format)
+{
+    if (format == PIX_FMT_RGB24)
+        return 3;
+    if (format == PIX_FMT_BGRA)
+        return 4;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (format == PIX_FMT_RGB32)
+        return 4;
+#endif
+    return 0;
+}
+
+bool YuvConvert::Supports(const ::AVFrame& src, const ::AVFrame& dst)
+{
+    if (src.format != PIX_FMT_YUV420P && src.format != PIX_FMT_YUVJ420P && src.format != PIX_FMT_NV12)
+        return false;
+    if (! BytesPerPixel(dst.format) || src.width < 2 || src.height < 2)
+        return false;
+    const bool same = dst.width == src.width && dst.height == src.height;
+    const bool half = dst.width == src.width / 2 && dst.height == src.height / 2;
+    return same || half;
+}
+
+YuvConvert::Matrix YuvConvert::GetMatrix(const ::AVFrame& frame)
+{
+    switch (frame.colorspace) {
+    case AVCOL_SPC_BT709:
+        return MATRIX_BT709;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL: // constant luminance only differs in how R'G'B' is weighted, close enough on screen
+        return MATRIX_BT2020;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+        return MATRIX_BT601;
+    default:
+        // Untagged material: HD is almost always BT.709, SD BT.601
+        return frame.height >= 720 ? MATRIX_BT709 : MATRIX_BT601;
+    }
+}
+
+bool YuvConvert::IsFullRange(const ::AVFrame& frame)
+{
+    return frame.format == PIX_FMT_YUVJ420P || frame.format == PIX_FMT_YUVJ422P || frame.format == PIX_FMT_YUVJ444P
+        || frame.color_range == AVCOL_RANGE_JPEG;
+}
+
+void YuvConvert::GetWeights(Matrix matrix, double& kr, double& kb)
+{
+    static const double kWeights[][2] = { { 0.299, 0.114 }, { 0.2126, 0.0722 }, { 0.2627, 0.0593 } };
+    kr = kWeights[matrix][0];
+    kb = kWeights[matrix][1];
+}
+
+Coefficients YuvConvert::MakeCoefficients(Matrix matrix, bool fullRange)
+{
+    double kr, kb;
+    GetWeights(matrix, kr, kb);
+    const double kg = 1.0 - kr - kb;
+    const double yScale = fullRange ? 1.0 : 255.0 / 219.0;
+    const double cScale = fullRange ? 1.0 : 255.0 / 224.0;
+    auto q13 = [](double value) { return int16_t(std::lround(value * 8192.0)); };
+
+    Coefficients c;
+    c.yOffset = fullRange ? 0 : 16;
+    c.yScale = q13(yScale);
+    c.crR = q13(2.0 * (1.0 - kr) * cScale);
+    c.cbG = q13(2.0 * (1.0 - kb) * kb / kg * cScale);
+    c.crG = q13(2.0 * (1.0 - kr) * kr / kg * cScale);
+    c.cbB = q13(2.0 * (1.0 - kb) * cScale);
+    return c;
+}
+
+// Samples are scaled by 64 and multiplied by Q13 coefficients with a rounding high multiply
+// ((a * b + 0x4000) >> 15, as pmulhrsw), which leaves the result scaled by 16. All kernels
+// use exactly this arithmetic, so they produce identical pictures.
+static inline int MulHrs(int a, int b)
+{
+    return (a * b + 0x4000) >> 15;
+}
+
+static inline uint8_t ToByte(int value)
+{
+    value = (value + 8) >> 4;
+    return uint8_t(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+template< int kBytes >
+static void RowScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, unsigned width, const Coefficients& c)
+{
+    for (unsigned x = 0; x < width; ++x, dst += kBytes) {
+        const int luma = MulHrs((y[x] - c.yOffset) * 64, c.yScale);
+        const int cb = (u[x] - 128) * 64, cr = (v[x] - 128) * 64;
+        const uint8_t r = ToByte(luma + MulHrs(cr, c.crR));
+        const uint8_t g = ToByte(luma - MulHrs(cb, c.cbG) - MulHrs(cr, c.crG));
+        const uint8_t b = ToByte(luma + MulHrs(cb, c.cbB));
+        if (kBytes == 3) {
+            dst[0] = r; dst[1] = g; dst[2] = b;
+        } else {
+            dst[0] = b; dst[1] = g; dst[2] = r; dst[3] = 255;
+        }
+    }
+}
+
+#if defined(YUVCONVERT_X86)
+
+// pshufb masks spreading 16 bytes of one channel over the 48 bytes of 16 RGB24 pixels
+struct Rgb24Masks {
+    alignas(16) int8_t mask[3][3][16]; // [output block][channel][byte]
+
+    Rgb24Masks()
+    {
+        for (int block = 0; block < 3; ++block)
+            for (int channel = 0; channel < 3; ++channel)
+                for (int j = 0; j < 16; ++j) {
+                    const int n = block * 16 + j;
+                    mask[block][channel][j] = int8_t(n % 3 == channel ? n / 3 : -128);
+                }
+    }
+};
+static const Rgb24Masks kRgb24Masks;
+
+template< int kBytes >
+__attribute__((target("sse4.1"))) static inline void Store16(uint8_t* dst, __m128i r, __m128i g, __m128i b)
+{
+    if (kBytes == 3) {
+        for (int block = 0; block < 3; ++block) {
+            const __m128i* m = reinterpret_cast<const __m128i*>(kRgb24Masks.mask[block]);
+            const __m128i out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, _mm_load_si128(m)),
+                                                          _mm_shuffle_epi8(g, _mm_load_si128(m + 1))),
+                                             _mm_shuffle_epi8(b, _mm_load_si128(m + 2)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16 * block), out);
+        }
+    } else {
+        const __m128i alpha = _mm_set1_epi8(char(255));
+        const __m128i bgLo = _mm_unpacklo_epi8(b, g), bgHi = _mm_unpackhi_epi8(b, g);
+        const __m128i raLo = _mm_unpacklo_epi8(r, alpha), raHi = _mm_unpackhi_epi8(r, alpha);
+        __m128i* out = reinterpret_cast<__m128i*>(dst);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(bgLo, raLo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bgLo, raLo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bgHi, raHi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bgHi, raHi));
+    }
+}
+
+// 8 pixels in 16 bit lanes
+__attribute__((target("sse4.1"))) static inline void Compute8(__m128i y, __m128i u, __m128i v, const Coefficients& c,
+                                                              __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i bias = _mm_set1_epi16(128), round = _mm_set1_epi16(8);
+    const __m128i luma = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(c.yOffset)), 6), _mm_set1_epi16(c.yScale));
+    const __m128i cb = _mm_slli_epi16(_mm_sub_epi16(u, bias), 6), cr = _mm_slli_epi16(_mm_sub_epi16(v, bias), 6);
+    r = _mm_add_epi16(luma, _mm_mulhrs_epi16(cr, _mm_set1_epi16(c.crR)));
+    g = _mm_sub_epi16(_mm_sub_epi16(luma, _mm_mulhrs_epi16(cb, _mm_set1_epi16(c.cbG))), _mm_mulhrs_epi16(cr, _mm_set1_epi16(c.crG)));
+    b = _mm_add_epi16(luma, _mm_mulhrs_epi16(cb, _mm_set1_epi16(c.cbB)));
+    r = _mm_srai_epi16(_mm_add_epi16(r, round), 4);
+    g = _mm_srai_epi16(_mm_add_epi16(g, round), 4);
+    b = _mm_srai_epi16(_mm_add_epi16(b, round), 4);
+}
+
+template< int kBytes >
+__attribute__((target("sse4.1"))) static void RowSse41(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+                                                       unsigned width, const Coefficients& c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        const __m128i u8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x));
+        const __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x));
+        __m128i rLo, gLo, bLo, rHi, gHi, bHi;
+        Compute8(_mm_cvtepu8_epi16(y8), _mm_cvtepu8_epi16(u8), _mm_cvtepu8_epi16(v8), c, rLo, gLo, bLo);
+        Compute8(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(u8, zero), _mm_unpackhi_epi8(v8, zero), c, rHi, gHi, bHi);
+        Store16<kBytes>(dst + x * kBytes, _mm_packus_epi16(rLo, rHi), _mm_packus_epi16(gLo, gHi), _mm_packus_epi16(bLo, bHi));
+    }
+    RowScalar<kBytes>(y + x, u + x, v + x, dst + x * kBytes, width - x, c);
+}
+
+// 16 pixels in 16 bit lanes
+__attribute__((target("avx2"))) static inline void Compute16(__m256i y, __m256i u, __m256i v, const Coefficients& c,
+                                                             __m256i& r, __m256i& g, __m256i& b)
+{
+    const __m256i bias = _mm256_set1_epi16(128), round = _mm256_set1_epi16(8);
+    const __m256i luma = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(c.yOffset)), 6),
+                                             _mm256_set1_epi16(c.yScale));
+    const __m256i cb = _mm256_slli_epi16(_mm256_sub_epi16(u, bias), 6), cr = _mm256_slli_epi16(_mm256_sub_epi16(v, bias), 6);
+    r = _mm256_add_epi16(luma, _mm256_mulhrs_epi16(cr, _mm256_set1_epi16(c.crR)));
+    g = _mm256_sub_epi16(_mm256_sub_epi16(luma, _mm256_mulhrs_epi16(cb, _mm256_set1_epi16(c.cbG))),
+                         _mm256_mulhrs_epi16(cr, _mm256_set1_epi16(c.crG)));
+    b = _mm256_add_epi16(luma, _mm256_mulhrs_epi16(cb, _mm256_set1_epi16(c.cbB)));
+    r = _mm256_srai_epi16(_mm256_add_epi16(r, round), 4);
+    g = _mm256_srai_epi16(_mm256_add_epi16(g, round), 4);
+    b = _mm256_srai_epi16(_mm256_add_epi16(b, round), 4);
+}
+
+// packus works per 128 bit lane, the permute puts the 32 pixels back in order
+__attribute__((target("avx2"))) static inline __m256i Pack32(__m256i lo, __m256i hi)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+template< int kBytes >
+__attribute__((target("avx2"))) static void RowAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+                                                    unsigned width, const Coefficients& c)
+{
+    unsigned x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const __m256i y8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+        const __m256i u8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + x));
+        const __m256i v8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + x));
+        __m256i rLo, gLo, bLo, rHi, gHi, bHi;
+        Compute16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(y8)), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(u8)),
+                  _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v8)), c, rLo, gLo, bLo);
+        Compute16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(y8, 1)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(u8, 1)),
+                  _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v8, 1)), c, rHi, gHi, bHi);
+        const __m256i r = Pack32(rLo, rHi), g = Pack32(gLo, gHi), b = Pack32(bLo, bHi);
+        Store16<kBytes>(dst + x * kBytes, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+        Store16<kBytes>(dst + (x + 16) * kBytes, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+                        _mm256_extracti128_si256(b, 1));
+    }
+    RowSse41<kBytes>(y + x, u + x, v + x, dst + x * kBytes, width - x, c);
+}
+
+#endif // YUVCONVERT_X86
+
+typedef void (*RowKernel)(const uint8_t*, const uint8_t*, const uint8_t*, uint8_t*, unsigned, const Coefficients&);
+
+static RowKernel SelectKernel(YuvConvert::Level level, int bytesPerPixel)
+{
+#if defined(YUVCONVERT_X86)
+    if (level == YuvConvert::LEVEL_AVX2)
+        return bytesPerPixel == 3 ? RowAvx2<3> : RowAvx2<4>;
+    if (level == YuvConvert::LEVEL_SSE41)
+        return bytesPerPixel == 3 ? RowSse41<3> : RowSse41<4>;
+#endif
+    (void)level;
+    return bytesPerPixel == 3 ? RowScalar<3> : RowScalar<4>;
+}
+
+static YuvConvert::Level DetectLevel()
+{
+#if defined(YUVCONVERT_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return YuvConvert::LEVEL_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return YuvConvert::LEVEL_SSE41;
+#endif
+    return YuvConvert::LEVEL_SCALAR;
+}
+
+static const YuvConvert::Level s_bestLevel = DetectLevel();
+static std::atomic<int> s_level(s_bestLevel);
+
+YuvConvert::Level YuvConvert::GetBestLevel() { return s_bestLevel; }
+YuvConvert::Level YuvConvert::GetLevel() { return Level(s_level.load()); }
+void YuvConvert::SetLevel(Level level) { s_level = std::min(level, s_bestLevel); }
+
+const char* YuvConvert::GetLevelName(Level level)
+{
+    static const char* kNames[] = { "scalar", "sse4.1", "avx2" };
+    return kNames[level];
+}
+
+// Chroma preparation: every kernel takes one U and one V sample per output pixel
+
+static void DuplicateSamples(const uint8_t* src, uint8_t* dst, unsigned width) // 4:2:0 chroma to full width
+{
+    unsigned x = 0;
+#if defined(__SSE2__)
+    for (; x + 32 <= width; x += 32) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x / 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_unpacklo_epi8(s, s));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 16), _mm_unpackhi_epi8(s, s));
+    }
+#endif
+    for (; x < width; ++x)
+        dst[x] = src[x / 2];
+}
+
+// NV12 interleaves U and V; `duplicate` spreads each pair over two output pixels
+static void SplitSamples(const uint8_t* uv, uint8_t* u, uint8_t* v, unsigned width, bool duplicate)
+{
+    unsigned x = 0;
+#if defined(__SSE2__)
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    if (duplicate) {
+        for (; x + 16 <= width; x += 16) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x));
+            const __m128i us = _mm_and_si128(s, low), vs = _mm_srli_epi16(s, 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_or_si128(us, _mm_slli_epi16(us, 8)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x), _mm_or_si128(vs, _mm_slli_epi16(vs, 8)));
+        }
+    } else {
+        for (; x + 16 <= width; x += 16) {
+            const __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x));
+            const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x + 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_packus_epi16(_mm_and_si128(s0, low), _mm_and_si128(s1, low)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x), _mm_packus_epi16(_mm_srli_epi16(s0, 8), _mm_srli_epi16(s1, 8)));
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        const unsigned pair = duplicate ? x / 2 : x;
+        u[x] = uv[2 * pair];
+        v[x] = uv[2 * pair + 1];
+    }
+}
+
+// 2x2 box filter for the halved luma, rounded to nearest
+static void HalveRows(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, unsigned width)
+{
+    unsigned x = 0;
+#if defined(__SSE2__)
+    const __m128i low = _mm_set1_epi16(0x00FF), two = _mm_set1_epi16(2);
+    for (; x + 16 <= width; x += 16) {
+        __m128i sum[2];
+        for (int half = 0; half < 2; ++half) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * x + 16 * half));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * x + 16 * half));
+            sum[half] = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)),
+                                      _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+            sum[half] = _mm_srli_epi16(_mm_add_epi16(sum[half], two), 2);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(sum[0], sum[1]));
+    }
+#endif
+    for (; x < width; ++x)
+        dst[x] = uint8_t((row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2);
+}
+
+bool YuvConvert::Convert(const ::AVFrame& src, ::AVFrame& dst)
+{
+    if (! Supports(src, dst))
+        return false;
+    ConvertRows(src, dst, 0, dst.height);
+    return true;
+}
+
+void YuvConvert::ConvertRows(const ::AVFrame& src, ::AVFrame& dst, unsigned first, unsigned last)
+{
+    const Coefficients c = MakeCoefficients(GetMatrix(src), IsFullRange(src));
+    const RowKernel kernel = SelectKernel(GetLevel(), BytesPerPixel(dst.format));
+
+    const bool nv12 = src.format == PIX_FMT_NV12;
+    const bool half = dst.width != src.width;
+    const unsigned width = dst.width;
+
+    static thread_local std::vector<uint8_t> scratch;
+    scratch.resize(size_t(width) * 3);
+    uint8_t* const luma = &scratch[0];
+    uint8_t* const u = luma + width;
+    uint8_t* const v = u + width;
+
+    for (unsigned row = first; row < last; ++row) {
+        const unsigned chromaRow = half ? row : row / 2;
+        const uint8_t* y = src.data[0] + size_t(half ? 2 * row : row) * src.linesize[0];
+        if (half) {
+            HalveRows(y, y + src.linesize[0], luma, width);
+            y = luma;
+        }
+        if (nv12) {
+            SplitSamples(src.data[1] + size_t(chromaRow) * src.linesize[1], u, v, width, ! half);
+        } else if (half) {
+            std::copy_n(src.data[1] + size_t(chromaRow) * src.linesize[1], width, u);
+            std::copy_n(src.data[2] + size_t(chromaRow) * src.linesize[2], width, v);
+        } else {
+            DuplicateSamples(src.data[1] + size_t(chromaRow) * src.linesize[1], u, width);
+            DuplicateSamples(src.data[2] + size_t(chromaRow) * src.linesize[2], v, width);
+        }
+        kernel(y, u, v, dst.data[0] + size_t(row) * dst.linesize[0], width, c);
+    }
+}
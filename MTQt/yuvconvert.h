@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Built-in conversion for the pictures the player converts all the time: YUV420P and NV12
+// to RGB24 or 32 bit BGRA, at the same size or halved in both directions. BT.601, BT.709 and
+// BT.2020, limited and full range. The row kernel is picked at run time from what the CPU supports;
+// everything else is left to swscale.
+class YuvConvert
+{
+public:
+    enum Level {
+        LEVEL_SCALAR,
+        LEVEL_SSE41,
+        LEVEL_AVX2
+    };
+
+    enum Matrix {
+        MATRIX_BT601,
+        MATRIX_BT709,
+        MATRIX_BT2020
+    };
+
+    // Q13 fixed point, applied to samples scaled by 64 (see the kernels)
+    struct Coefficients {
+        int16_t  yOffset;
+        int16_t  yScale;
+        int16_t  crR;
+        int16_t  cbG;
+        int16_t  crG;
+        int16_t  cbB;
+    };
+
+    static bool Supports(const ::AVFrame& src, const ::AVFrame& dst);
+
+    // Returns false, without touching `dst`, if the pair is not supported
+    static bool Convert(const ::AVFrame& src, ::AVFrame& dst);
+
+    // Converts the output rows [first, last); lets callers split a picture into bands
+    static void ConvertRows(const ::AVFrame& src, ::AVFrame& dst, unsigned first, unsigned last);
+
+    // The matrix and range of a frame, for every path that turns its YUV into RGB
+    static Matrix GetMatrix(const ::AVFrame& frame);
+    static bool IsFullRange(const ::AVFrame& frame);
+    static void GetWeights(Matrix matrix, double& kr, double& kb); // luma weights of red and blue
+
+    static Coefficients MakeCoefficients(Matrix matrix, bool fullRange);
+
+    static Level GetBestLevel();
+    static Level GetLevel();
+    static void SetLevel(Level level); // limited to GetBestLevel(), for benchmarks
+    static const char* GetLevelName(Level level);
+};